@@ -2,10 +2,12 @@
 
 #include <unistd.h>
 #include <string.h>
+#include <stdbool.h>
 #include <time.h>
 
 #include "FreeRTOS.h"
 #include "task.h"
+#include "semphr.h"
 
 #include "lwip/err.h"
 #include "lwip/sockets.h"
@@ -13,51 +15,329 @@
 #include "lwip/netdb.h"
 #include "lwip/dns.h"
 
-#include "ws2812.h"
 #include "art_net.h"
+#if ART_NET_RAW_UDP
+#include "event_groups.h"
+#include "queue.h"
+#include "lwip/udp.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcpip.h"
+#endif
+
+#include "ws2812.h"
+#include "cue.h"
+#include "monitor.h"
+#include "timesync.h"
+#include "playout.h"
+#include "merge.h"
+#include "probe.h"
 #include "wifi.h"
 #include "logger.h"
-#include "sysparam_macros.h"
+#include "config.h"
 
 
 #define ART_NET_DMX 0x5000
+#define ART_NET_ADDRESS 0x6000
+#define ART_NET_TIMECODE 0x9700
 #define ART_NET_WIFI_SETTINGS_STA 0xf823
 #define ART_NET_WIFI_SETTINGS_AP 0xf824
 #define ART_NET_DMX_SETTINGS 0xf825
+#define ART_NET_SHADER 0xf826
+#define ART_NET_CUE_STORE 0xf827
+#define ART_NET_CUE_CONTROL 0xf828
+#define ART_NET_LAYER 0xf829
+#define ART_NET_MONITOR 0xf82a
+#define ART_NET_TIMED_DMX 0xf82c
+#define ART_NET_SEGMENTS 0xf82e
+#define ART_NET_PIXEL_MAP 0xf82f
 #define ART_NET_MAX_PACKET 600
+#define ART_NET_MAX_REPLY 128
 static const char ART_NET_TAG[8] = "Art-Net";
 static const char *TAG = ART_NET_TAG;
 static uint16_t universe=ART_NET_UNIVERSE;
 static uint16_t shift=ART_NET_SHIFT;
 
-#define SEQUENCE_MIN 0x01
+// replies go to the sender of the packet being parsed
+#if ART_NET_RAW_UDP
+static struct udp_pcb *raw_pcb = NULL;
+static ip_addr_t reply_ip;
+static u16_t reply_port;
+#else
+static int reply_sock = -1;
+static struct sockaddr_in reply_addr;
+#endif
+static uint32_t packet_arrival; // us of sdk_system_get_time when the packet being parsed was received
+
 #define SEQUENCE_MAX 0xff
 
-static uint8_t previous_sequence=0;
+struct sequence_source {
+    uint8_t used;
+    uint8_t last; // 0 if not known
+    uint8_t late; // last late sequence
+    uint8_t late_count; // late packets in a row, each following the previous one
+    uint16_t universe;
+    uint32_t ip;
+    TickType_t seen;
+};
+
+// DMX is filtered in the lwIP thread by the raw path and in udp_server_task, the sequence table
+// and the counters are only touched with sources_lock taken
+static SemaphoreHandle_t sources_lock;
+static struct sequence_source sources[SEQUENCE_SOURCES];
+static struct art_net_stats stats;
+
+static bool take_sources() {
+    if(xSemaphoreTake(sources_lock, 100) == pdTRUE) return true;
+    LOGE("FAILED TO TAKE LOCK");
+    return false;
+}
+
+static void count(uint32_t *counter) {
+    if(!take_sources()) return;
+    ++*counter;
+    xSemaphoreGive(sources_lock);
+}
+
+/**
+ * Must be called with sources_lock taken.
+ */
+static struct sequence_source *find_source(uint32_t ip, uint16_t _universe, TickType_t now) {
+    struct sequence_source *s, *slot = NULL;
+    for(s=sources;s<sources+SEQUENCE_SOURCES;++s) {
+        if(s->used && s->ip == ip && s->universe == _universe) {
+            if(now - s->seen >= SEQUENCE_TIMEOUT / portTICK_PERIOD_MS) {
+                LOGD("Sequence of %08x reset after silence", ip);
+                s->last = 0;
+                s->late_count = 0;
+            }
+            return s;
+        }
+        if(!slot || (slot->used && (!s->used || (int32_t)(s->seen - slot->seen) < 0))) slot = s;
+    }
+    *slot = (struct sequence_source){.used = 1, .universe = _universe, .ip = ip};
+    return slot;
+}
+
+/**
+ * Returns true if the DMX packet is newer than the previous one from its sender.
+ * Must be called with sources_lock taken.
+ */
+static bool check_sequence(uint8_t sequence, uint16_t _universe, uint32_t ip) {
+    struct sequence_source *s;
+    TickType_t now;
+    int ahead;
+
+    now = xTaskGetTickCount();
+    s = find_source(ip, _universe, now);
+    s->seen = now;
+    if(sequence > 0 && s->last > 0) {
+        ahead = (sequence - s->last + SEQUENCE_MAX) % SEQUENCE_MAX;
+        if(ahead == 0 || ahead >= SEQUENCE_MAX - SEQUENCE_WINDOW) {
+            // reordered packets come one by one, a restarted sender goes on in order
+            s->late_count = s->late_count && sequence == s->late % SEQUENCE_MAX + 1 ? s->late_count + 1 : 1;
+            s->late = sequence;
+            if(s->late_count < SEQUENCE_RESYNC) {
+                LOGD("Late sequence %d, last %d", sequence, s->last);
+                ++stats.late;
+                return false;
+            }
+            LOGI("Sender %08x restarted at sequence %d", ip, sequence);
+            ++stats.resyncs;
+        }
+    }
+    s->last = sequence;
+    s->late_count = 0;
+    ++stats.frames;
+    return true;
+}
+
+static bool for_us(uint16_t _universe) {
+    // with segments the strip takes every universe a segment is subscribed to
+    if(!art_net_universe(_universe)){
+        LOGD("Wrong universe, not for us");
+        count(&stats.other_universe);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Returns true if the DMX packet is for our universe and newer than the previous one from its sender.
+ */
+static bool accept_dmx(uint8_t sequence, uint16_t _universe, uint32_t ip) {
+    bool accepted;
+
+    if(!for_us(_universe) || !take_sources()) return false;
+    accepted = check_sequence(sequence, _universe, ip);
+    xSemaphoreGive(sources_lock);
+    return accepted;
+}
+
+/**
+ * Returns true if a sender other than ip sent DMX to the universe within MERGE_TIMEOUT ms.
+ * Must be called with sources_lock taken.
+ */
+static bool other_sender(uint16_t _universe, uint32_t ip) {
+    TickType_t now = xTaskGetTickCount();
+    for(struct sequence_source *s=sources;s<sources+SEQUENCE_SOURCES;++s) {
+        if(s->used && s->universe == _universe && s->ip != ip && now - s->seen < MERGE_TIMEOUT / portTICK_PERIOD_MS) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool merging(uint16_t _universe, uint32_t ip) {
+    bool other;
+    if(!take_sources()) return false;
+    other = other_sender(_universe, ip);
+    xSemaphoreGive(sources_lock);
+    return other;
+}
+
+#if ART_NET_RAW_UDP
+/**
+ * Returns 1 if the DMX packet is accepted and no other sender merges into its universe, 0 if it is dropped,
+ * or -1 if it is to be merged by the task. Both checks are done in one hold of sources_lock,
+ * so the task can't take in a second sender between them.
+ */
+static int accept_unmerged(uint8_t sequence, uint16_t _universe, uint32_t ip) {
+    int ret;
+    if(!for_us(_universe) || !take_sources()) return 0;
+    ret = other_sender(_universe, ip) ? -1 : check_sequence(sequence, _universe, ip);
+    xSemaphoreGive(sources_lock);
+    return ret;
+}
+#endif
+
+void art_net_get_stats(struct art_net_stats *out) {
+    if(!take_sources()) return;
+    *out = stats;
+    xSemaphoreGive(sources_lock);
+}
+
+static struct playout playout;
+
+/**
+ * Shows our DMX slice at once or, with a playout budget set, schedules it by the timing of the stream.
+ */
+static void present_dmx(struct playout *stream, uint8_t* values, uint16_t length, uint32_t arrival_us) {
+    uint32_t budget = config.playout_budget;
+    if(!budget) {
+        ws2812_update(values, length);
+        return;
+    }
+    if(budget > PLAYOUT_MAX_DELAY) budget = PLAYOUT_MAX_DELAY;
+    ws2812_schedule(values, length, playout_due(stream, arrival_us, budget * 1000));
+}
+
+bool art_net_universe(uint16_t _universe) {
+    return ws2812_segment_count() ? ws2812_segment_universe(_universe) : _universe == universe;
+}
+
+int art_net_universes(uint16_t *out, int max) {
+    if(ws2812_segment_count()) return ws2812_segment_universes(out, max);
+    if(max < 1) return 0;
+    out[0] = universe;
+    return 1;
+}
+
+void art_net_show_dmx(struct playout *stream, uint16_t _universe, uint8_t* values, uint16_t length, uint32_t arrival_us) {
+    if(ws2812_segment_count()) {
+        ws2812_update_segments(_universe, values, length);
+    } else if(length>shift) {
+        present_dmx(stream, values+shift, length-shift, arrival_us);
+    }
+}
+
+/**
+ * Returns the sender of the packet being parsed, IPv4 in network byte order.
+ */
+static uint32_t sender_ip() {
+#if ART_NET_RAW_UDP
+    return ip_addr_get_ip4_u32(&reply_ip);
+#else
+    return reply_addr.sin_addr.s_addr;
+#endif
+}
+
+void art_net_sender(uint32_t *ip, uint16_t *port) {
+    *ip = sender_ip();
+#if ART_NET_RAW_UDP
+    *port = reply_port;
+#else
+    *port = ntohs(reply_addr.sin_port);
+#endif
+}
+
 void parse_dmx(uint8_t sequence, uint16_t _universe, uint16_t length, uint8_t* values) {
     LOGD("Got Art-Net DMX seq: %d, univ: %d, len: %d, %02x%02x%02x%02x%02x%02x...",
             sequence, universe, length, values[0], values[1], values[2], values[3], values[4], values[5]);
-    if(_universe != universe){
-        LOGD("Wrong universe, not for us");
+    uint32_t ip = sender_ip(), now_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    if(!accept_dmx(sequence, _universe, ip)) return;
+    if(merging(_universe, ip)) {
+        int merged = merge_frame(config.merge_mode, ip, _universe, values, length, now_ms, &values);
+        if(merged == 0) return;
+        if(merged > 0) length = merged; // out of room the sources are shown as they come
+    } else {
+        merge_shown(ip, _universe, values, length, now_ms);
+    }
+    art_net_show_dmx(&playout, _universe, values, length, sdk_system_get_time());
+}
+
+/**
+ * ArtDmx with a presentation time of the shared clock, always scheduled.
+ */
+void parse_timed_dmx(uint64_t pts_us, uint8_t sequence, uint16_t _universe, uint16_t length, uint8_t* values) {
+    int64_t ahead = pts_us - timesync_now_us();
+    LOGD("Got timed DMX seq: %d, univ: %d, len: %d, in %d us", sequence, _universe, length, (int)ahead);
+    if(!accept_dmx(sequence, _universe, sender_ip())) return;
+    if(ws2812_segment_count()) { // segments are shown at once
+        ws2812_update_segments(_universe, values, length);
         return;
     }
+    if(length<=shift) return;
+    if(ahead < 0) ahead = 0;
+    if(ahead > PLAYOUT_MAX_DELAY * 1000) ahead = PLAYOUT_MAX_DELAY * 1000;
+    ws2812_schedule(values+shift, length-shift, sdk_system_get_time() + ahead);
+}
 
-    if(sequence>0) {
-        if(sequence <= previous_sequence) {
-            if(sequence>SEQUENCE_ROLLOVER_TOLERANCE + SEQUENCE_MIN ||
-                    previous_sequence < SEQUENCE_MAX - SEQUENCE_ROLLOVER_TOLERANCE) {
-                return;
-            }
-        }
+/**
+ * Parses the ArtDmx header after the opcode, len is the whole packet length.
+ * Returns 0 on success or negative error code.
+ */
+static int parse_dmx_header(uint8_t* I, int len, uint8_t* sequence, uint16_t* _universe, uint16_t* length) {
+    if(len<18) {
+        LOGD("Art-Net DMX packet has insufficient length to hold arguments");
+        count(&stats.invalid);
+        return -1; // insufficient length
+    }
+    if(I[0]!=0 || I[1]!=14){
+        LOGW("Art-Net DMX packet protocol version mismatch. Got %02x%02x", I[0], I[1]);
+        count(&stats.invalid);
+        return -2; // protocol mismatch
     }
-    previous_sequence = sequence;
-    if(length>shift) ws2812_update(values+shift, length-shift);
+    I+=2;//12
+    *sequence = *I;
+    I+=2; //14 skip port
+    *_universe = I[1];
+    *_universe <<= 8;
+    *_universe += I[0];
+    I+=2;//16
+    *length = *(I++);
+    *length <<=8;
+    *length += *(I++);//18
+    if(*length > len-18){
+        LOGW("Art-Net DMX packet length (%d) is insufficient to fit stated payload length %d",
+                len, *length);
+        count(&stats.invalid);
+        return -3; // insufficient payload length
+    }
+    return 0;
 }
 
 int parse_dmx_settings(size_t len, uint8_t* buf) {
     LOGV("Update dmx_settings, len: %d", len);
-    int32_t temp;
-    int err;
 
     if(len<4) {
         LOGE("DMX settings buf is too small");
@@ -76,20 +356,118 @@ int parse_dmx_settings(size_t len, uint8_t* buf) {
     new_shift += I[0];
     LOGV("Updating universe_number: %d, shift: %d, saving...", new_universe, new_shift);
 
-    temp = new_universe;
-    SPTW_SETR(int32, dmx_universe, temp, return -2);
-    universe = new_universe;
-
-    temp = new_shift;
-    SPTW_SETR(int32, dmx_shift, temp, return -2);
-    shift = new_shift;
+    universe = config.dmx_universe = new_universe;
+    shift = config.dmx_shift = new_shift;
+    if(len>=6) {
+        I+=2;//18
+        config.playout_budget = I[1];
+        config.playout_budget <<= 8;
+        config.playout_budget += I[0];
+        LOGI("Playout budget: %d ms", config.playout_budget);
+    }
+    config_save();
 
     LOGI("New DMX Universe: %d, shift (DMX Address): %d", new_universe, new_shift);
     return 0;
 }
 
+/**
+ * ArtAddress, only the command is taken: AcCancelMerge, AcMergeLtp0-3 and AcMergeHtp0-3 set the merge mode.
+ */
+void parse_address_command(uint8_t command) {
+    switch(command) {
+    case 0x01: // AcCancelMerge, the next frame ends a merge anyway
+        LOGV("ArtAddress AcCancelMerge");
+        return;
+    case 0x10: case 0x11: case 0x12: case 0x13:
+        config.merge_mode = MERGE_LTP;
+        break;
+    case 0x50: case 0x51: case 0x52: case 0x53:
+        config.merge_mode = MERGE_HTP;
+        break;
+    default:
+        LOGV("Ignoring ArtAddress command %02x", command);
+        return;
+    }
+    config_save();
+    LOGI("Merge mode: %s", config.merge_mode == MERGE_LTP ? "LTP" : "HTP");
+}
+
+static const uint8_t timecode_fps[] = {24, 25, 30, 30};
+
+void parse_timecode(uint8_t* buf) {
+    // FRAMES + SECONDS + MINUTES + HOURS + TYPE, 29.97 drop frame is counted as 30 fps
+    uint8_t fps = timecode_fps[buf[4] & 3];
+    uint32_t ms = ((buf[3] * 60 + buf[2]) * 60 + buf[1]) * 1000;
+    ms += buf[0] * 1000 / fps;
+    LOGV("Got Art-Net TimeCode %02d:%02d:%02d.%02d, %d ms", buf[3], buf[2], buf[1], buf[0], ms);
+    cue_timecode(ms);
+}
+
+#if ART_NET_RAW_UDP
+static int send_packet(const ip_addr_t *ip, u16_t port, uint16_t opcode, uint8_t* payload, size_t len) {
+    struct pbuf *p;
+    err_t err;
+    if(!raw_pcb || len > ART_NET_MAX_REPLY - 10) return -1;
+    if(!(p = pbuf_alloc(PBUF_TRANSPORT, len + 10, PBUF_RAM))) {
+        LOGE("pbuf_alloc failed");
+        return -2;
+    }
+    uint8_t *buf = p->payload;
+#else
+static int send_packet(const struct sockaddr_in *to, uint16_t opcode, uint8_t* payload, size_t len) {
+    uint8_t buf[ART_NET_MAX_REPLY];
+    if(reply_sock < 0 || len > ART_NET_MAX_REPLY - 10) return -1;
+#endif
+    memcpy(buf, ART_NET_TAG, sizeof(ART_NET_TAG));
+    buf[8] = opcode & 0xff;
+    buf[9] = opcode >> 8;
+    memcpy(buf + 10, payload, len);
+#if ART_NET_RAW_UDP
+    LOCK_TCPIP_CORE();
+    err = udp_sendto(raw_pcb, p, ip, port);
+    UNLOCK_TCPIP_CORE();
+    pbuf_free(p);
+    if(err != ERR_OK) {
+        LOGE("udp_sendto failed (%d)", err);
+        return -2;
+    }
+#else
+    if(sendto(reply_sock, buf, len + 10, 0, (const struct sockaddr *)to, sizeof(*to)) < 0) {
+        LOGE("sendto failed: errno %d", errno);
+        return -2;
+    }
+#endif
+    return 0;
+}
+
+int art_net_reply(uint16_t opcode, uint8_t* payload, size_t len) {
+#if ART_NET_RAW_UDP
+    return send_packet(&reply_ip, reply_port, opcode, payload, len);
+#else
+    return send_packet(&reply_addr, opcode, payload, len);
+#endif
+}
+
+int art_net_send(uint32_t ip, uint16_t opcode, uint8_t* payload, size_t len) {
+    return art_net_send_to(ip, ART_NET_PORT, opcode, payload, len);
+}
+
+int art_net_send_to(uint32_t ip, uint16_t port, uint16_t opcode, uint8_t* payload, size_t len) {
+#if ART_NET_RAW_UDP
+    ip_addr_t to;
+    ip_addr_set_ip4_u32(&to, ip);
+    return send_packet(&to, port, opcode, payload, len);
+#else
+    struct sockaddr_in to = {.sin_family = AF_INET, .sin_port = htons(port)};
+    to.sin_addr.s_addr = ip;
+    return send_packet(&to, opcode, payload, len);
+#endif
+}
+
 void parse_art_net(int len, uint8_t* buf) {
     uint8_t* I, *end=buf+len;
+    uint64_t pts;
     if(len<10 || memcmp(buf, ART_NET_TAG, sizeof(ART_NET_TAG))){
         LOGD("Packet is not Art-Net packet");
         // not art-net
@@ -102,32 +480,27 @@ void parse_art_net(int len, uint8_t* buf) {
     I += 2;//10
     LOGV("Got Art-Net packet with opcode %04x", opcode);
     switch(opcode){
-    case ART_NET_DMX:
+    case ART_NET_DMX: {
+        uint8_t sequence;
+        uint16_t universe, length;
+        if(parse_dmx_header(I, len, &sequence, &universe, &length) != 0) return;
+        parse_dmx(sequence, universe, length, buf+18);
+        break;
+    }
+    case ART_NET_TIMED_DMX: {
+        // PTS + ArtDmx from the protocol version on
+        uint8_t sequence;
+        uint16_t universe, length;
         if(len<18) {
-            LOGD("Art-Net DMX packet has insufficient length to hold arguments");
-            return; // insufficient length
+            LOGD("Art-Net TIMED_DMX packet has insufficient length");
+            return;
         }
-        if(I[0]!=0 || I[1]!=14){
-            LOGW("Art-Net DMX packet protocol version mismatch. Got %02x%02x", I[0], I[1]);
-            return; // protocol mismatch
-        }
-        I+=2;//12
-        uint8_t sequence = *I;
-        I+=2; //14 skip port
-        uint16_t universe = I[1];
-        universe <<= 8;
-        universe += I[0];
-        I+=2;//16
-        uint16_t length = *(I++);
-        length <<=8;
-        length += *(I++);//18
-        if(length > len-18){
-            LOGW("Art-Net DMX packet length (%d) is insufficient to fit stated payload length %d",
-                    len, length);
-            return; // insufficient payload length
-        }
-        parse_dmx(sequence, universe, length, I);
+        pts = 0;
+        for(int i=0;i<8;++i) pts = pts << 8 | I[i];
+        if(parse_dmx_header(I+8, len-8, &sequence, &universe, &length) != 0) return;
+        parse_timed_dmx(pts, sequence, universe, length, buf+26);
         break;
+    }
     case ART_NET_WIFI_SETTINGS_STA:
         if(end-I > 0){
             int err = update_wifi_station_settings((char*)I, end-I);
@@ -152,12 +525,254 @@ void parse_art_net(int len, uint8_t* buf) {
             }
         }
         break;
+    case ART_NET_SHADER:
+        if(end-I > 0){
+            int err = ws2812_set_shader(I, end-I);
+            if(err != 0){
+                LOGW("Art-Net SHADER execution failure (%d)", err);
+            }
+        }
+        break;
+    case ART_NET_CUE_STORE:
+        if(end-I > 0){
+            int err = cue_store(I, end-I);
+            if(err != 0){
+                LOGW("Art-Net CUE_STORE execution failure (%d)", err);
+            }
+        }
+        break;
+    case ART_NET_CUE_CONTROL:
+        if(end-I > 0){
+            int err = cue_command(I, end-I);
+            if(err != 0){
+                LOGW("Art-Net CUE_CONTROL execution failure (%d)", err);
+            }
+        }
+        break;
+    case ART_NET_SEGMENTS:
+        if(end-I > 0){
+            int err = ws2812_set_segments(I, end-I);
+            if(err != 0){
+                LOGW("Art-Net SEGMENTS execution failure (%d)", err);
+            }
+        }
+        break;
+    case ART_NET_PIXEL_MAP:
+        if(end-I > 0){
+            int err = ws2812_set_map(I, end-I);
+            if(err != 0){
+                LOGW("Art-Net PIXEL_MAP execution failure (%d)", err);
+            }
+        }
+        break;
+    case ART_NET_LAYER:
+        if(end-I > 0){
+            int err = ws2812_set_layer(I, end-I);
+            if(err != 0){
+                LOGW("Art-Net LAYER execution failure (%d)", err);
+            }
+        }
+        break;
+    case ART_NET_MONITOR:
+        if(end == I){ // replies carry a payload and are ignored
+            uint8_t report[ART_NET_MAX_REPLY - 10];
+            uint32_t counters[5];
+            struct art_net_stats now = {0};
+            int report_len = monitor_report(report, sizeof(report) - sizeof(counters));
+            if(report_len >= 0) {
+                // DMX counters follow the monitor report
+                art_net_get_stats(&now);
+                counters[0] = now.frames;
+                counters[1] = now.late;
+                counters[2] = now.resyncs;
+                counters[3] = now.other_universe;
+                counters[4] = now.invalid;
+                for(int i=0;i<5;++i, report_len+=4) {
+                    report[report_len]   = counters[i] >> 24;
+                    report[report_len+1] = counters[i] >> 16;
+                    report[report_len+2] = counters[i] >> 8;
+                    report[report_len+3] = counters[i];
+                }
+            }
+            int err = report_len < 0 ? report_len : art_net_reply(ART_NET_MONITOR, report, report_len);
+            if(err != 0){
+                LOGW("Art-Net MONITOR execution failure (%d)", err);
+            }
+        }
+        break;
+    case ART_NET_TIME_SYNC:
+        if(end-I > 0){
+            int err = timesync_command(I, end-I, packet_arrival);
+            if(err != 0){
+                LOGW("Art-Net TIME_SYNC execution failure (%d)", err);
+            }
+        }
+        break;
+    case ART_NET_PROBE:
+        if(end-I > 0){
+            int err = probe_command(I, end-I, packet_arrival);
+            if(err != 0){
+                LOGW("Art-Net PROBE execution failure (%d)", err);
+            }
+        }
+        break;
+    case ART_NET_ADDRESS:
+        if(len<107) {
+            LOGD("ArtAddress packet has insufficient length");
+            return;
+        }
+        parse_address_command(buf[106]);
+        break;
+    case ART_NET_TIMECODE:
+        if(len<19) {
+            LOGD("Art-Net TimeCode packet has insufficient length");
+            return;
+        }
+        parse_timecode(I+4);
+        break;
     default:
         LOGV("Ignoring opcode %04x", opcode);
         break;
     }
 }
 
+#if ART_NET_RAW_UDP
+
+#define DMX_READY_BIT BIT0
+#define PACKET_READY_BIT BIT1
+
+struct raw_packet {
+    struct pbuf *p;
+    ip_addr_t addr;
+    u16_t port;
+    uint32_t arrival;
+};
+
+static EventGroupHandle_t raw_event_group;
+static QueueHandle_t raw_packets; // packets other than DMX, parsed by the task
+// latest DMX packet for us, a newer one replaces it like the socket path skips stale packets
+static struct pbuf *dmx_pbuf = NULL;
+static uint16_t dmx_universe, dmx_length;
+static uint32_t dmx_ip, dmx_arrival;
+
+/**
+ * Runs in the lwIP thread: DMX is filtered by the header read straight from the pbuf,
+ * so packets for other universes are dropped without a copy or a task switch.
+ */
+static void raw_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    uint8_t header[18];
+    uint8_t sequence;
+    uint16_t _universe, length;
+    struct pbuf *old;
+    int len = pbuf_copy_partial(p, header, sizeof(header), 0);
+
+    // with segments a packet may feed several of them, merged sources need their frames kept,
+    // such packets are parsed by the task like the others
+    if(len >= 10 && !memcmp(header, ART_NET_TAG, sizeof(ART_NET_TAG))
+            && (header[8] | (header[9] << 8)) == ART_NET_DMX && !ws2812_segment_count()) {
+        if(parse_dmx_header(header + 10, p->tot_len, &sequence, &_universe, &length) != 0) {
+            pbuf_free(p);
+            return;
+        }
+        int accepted = accept_unmerged(sequence, _universe, ip_addr_get_ip4_u32(addr));
+        if(accepted >= 0) {
+            if(!accepted || length <= shift) {
+                pbuf_free(p);
+                return;
+            }
+            taskENTER_CRITICAL();
+            old = dmx_pbuf;
+            dmx_pbuf = p;
+            dmx_universe = _universe;
+            dmx_length = length;
+            dmx_ip = ip_addr_get_ip4_u32(addr);
+            dmx_arrival = sdk_system_get_time();
+            taskEXIT_CRITICAL();
+            if(old) pbuf_free(old);
+            xEventGroupSetBits(raw_event_group, DMX_READY_BIT);
+            return;
+        }
+    }
+
+    struct raw_packet packet = {.p = p, .port = port, .arrival = sdk_system_get_time()};
+    ip_addr_copy(packet.addr, *addr);
+    if(xQueueSend(raw_packets, &packet, 0) != pdTRUE) {
+        LOGW("Packet queue is full, dropping");
+        pbuf_free(p);
+        return;
+    }
+    xEventGroupSetBits(raw_event_group, PACKET_READY_BIT);
+}
+
+static void udp_server_task(void *pvParameters)
+{
+    uint8_t* rx_buffer=malloc(ART_NET_MAX_PACKET);
+    struct raw_packet packet;
+    struct pbuf *p;
+    uint8_t *values;
+    uint16_t _universe, length;
+    uint32_t ip, arrival;
+    err_t err = ERR_MEM;
+    LOGI("Started task");
+
+    LOGI("DMX Universe: %d, shift (DMX Address): %d", universe, shift);
+    LOCK_TCPIP_CORE();
+    if((raw_pcb = udp_new())) {
+        ip_set_option(raw_pcb, SOF_BROADCAST);
+        if((err = udp_bind(raw_pcb, IP_ADDR_ANY, ART_NET_PORT)) == ERR_OK) {
+            udp_recv(raw_pcb, raw_recv, NULL);
+        } else {
+            udp_remove(raw_pcb);
+            raw_pcb = NULL;
+        }
+    }
+    UNLOCK_TCPIP_CORE();
+    if(err != ERR_OK) {
+        LOGE("Unable to bind port %d (%d)", ART_NET_PORT, err);
+        vTaskDelete(NULL);
+        return;
+    }
+    LOGI("Listening on port %d", ART_NET_PORT);
+
+    while (1) {
+        xEventGroupWaitBits(raw_event_group, DMX_READY_BIT | PACKET_READY_BIT, pdTRUE, pdFALSE, portMAX_DELAY);
+
+        taskENTER_CRITICAL();
+        p = dmx_pbuf;
+        dmx_pbuf = NULL;
+        _universe = dmx_universe;
+        length = dmx_length;
+        ip = dmx_ip;
+        arrival = dmx_arrival;
+        taskEXIT_CRITICAL();
+        if(p) {
+            if(18 + length <= p->len) {
+                values = (uint8_t*)p->payload + 18;
+            } else { // chained pbuf
+                if(length > ART_NET_MAX_PACKET) length = ART_NET_MAX_PACKET;
+                values = rx_buffer;
+                length = pbuf_copy_partial(p, rx_buffer, length, 18);
+            }
+            merge_shown(ip, _universe, values, length, xTaskGetTickCount() * portTICK_PERIOD_MS);
+            if(length > shift) present_dmx(&playout, values + shift, length - shift, arrival);
+            pbuf_free(p);
+        }
+
+        while(xQueueReceive(raw_packets, &packet, 0) == pdTRUE) {
+            int len = pbuf_copy_partial(packet.p, rx_buffer, ART_NET_MAX_PACKET, 0);
+            pbuf_free(packet.p);
+            reply_ip = packet.addr;
+            reply_port = packet.port;
+            packet_arrival = packet.arrival;
+            LOGV("Received %d bytes", len);
+            parse_art_net(len, rx_buffer);
+        }
+    }
+    vTaskDelete(NULL);
+}
+
+#else
+
 static void udp_server_task(void *pvParameters)
 {
     char* rx_buffer=malloc(ART_NET_MAX_PACKET);
@@ -193,6 +808,7 @@ static void udp_server_task(void *pvParameters)
             LOGE("Socket unable to bind: errno %d", errno);
         }
         LOGI("Listening on port %d", ART_NET_PORT);
+        reply_sock = sock;
 
         while (1) {
             IFLOGD(s2=sdk_system_get_time();
@@ -201,6 +817,7 @@ static void udp_server_task(void *pvParameters)
             struct sockaddr_in sourceAddr;
             socklen_t socklen = sizeof(sourceAddr);
             int len = recvfrom(sock, rx_buffer, ART_NET_MAX_PACKET, 0, (struct sockaddr *)&sourceAddr, &socklen);
+            packet_arrival = sdk_system_get_time();
             IFLOGD(s3=sdk_system_get_time();
             d2=s3-s2;)
 
@@ -215,13 +832,15 @@ static void udp_server_task(void *pvParameters)
                 // Get the sender's ip address as string
                 inet_ntoa_r(((struct sockaddr_in *)&sourceAddr)->sin_addr.s_addr, addr_str, sizeof(addr_str) - 1);
                 LOGV("Received %d bytes from %s", len, addr_str);
+                reply_addr = sourceAddr;
                 parse_art_net(len, (uint8_t*)rx_buffer);
             }
             IFLOGD(s4=sdk_system_get_time();
             d3=s4-s3;)
             LOGD(LOG_COLOR(LOG_COLOR_CYAN)"UDP process: wait packets %d, reloop: %d, process: %d, total: %d"LOG_RESET_COLOR, d2,d1,d3,d1+d2+d3);
-            while((len = recvfrom(sock, rx_buffer, ART_NET_MAX_PACKET, MSG_DONTWAIT,
-                    (struct sockaddr *)&sourceAddr, &socklen))>0) {} // skip packets that arrived during processing time
+            // skip packets that arrived during processing time, unless they are buffered for playout
+            while(!config.playout_budget && (len = recvfrom(sock, rx_buffer, ART_NET_MAX_PACKET, MSG_DONTWAIT,
+                    (struct sockaddr *)&sourceAddr, &socklen))>0) {}
             if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
                 LOGE("while clearing, recvfrom failed: errno %d", errno);
                 break;
@@ -229,6 +848,7 @@ static void udp_server_task(void *pvParameters)
         }
 
         if (sock != -1) {
+            reply_sock = -1;
             LOGI("Shutting down socket and restarting...");
             shutdown(sock, 0);
             close(sock);
@@ -237,19 +857,20 @@ static void udp_server_task(void *pvParameters)
     vTaskDelete(NULL);
 }
 
-void init_server() {
-    int err;
-    int32_t temp;
-
-    temp = universe;
-    SPTW_GETR(int32, dmx_universe, temp, return);
-    universe = temp;
+#endif
 
-    temp = shift;
-    SPTW_GETR(int32, dmx_shift, temp, return);
-    shift = temp;
+void init_server() {
+    universe = config.dmx_universe;
+    shift = config.dmx_shift;
+    sources_lock = xSemaphoreCreateMutex();
 
-    xTaskCreate(udp_server_task, "udp_server", 4096, NULL, 5, NULL);
+#if ART_NET_RAW_UDP
+    raw_event_group = xEventGroupCreate();
+    raw_packets = xQueueCreate(ART_NET_RAW_QUEUE, sizeof(struct raw_packet));
+#endif
+    TaskHandle_t task = NULL;
+    xTaskCreate(udp_server_task, "udp_server", 4096, NULL, 5, &task);
+    monitor_register(task);
 }
 
 
@@ -1,6 +1,10 @@
 #ifndef ART_NET_H_
 #define ART_NET_H_
 
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
 #ifndef ART_NET_PORT
 #define ART_NET_PORT 6454
 #endif
@@ -12,10 +16,99 @@
 #define ART_NET_UNIVERSE 0
 #endif
 
-#ifndef SEQUENCE_ROLLOVER_TOLERANCE
-#define SEQUENCE_ROLLOVER_TOLERANCE 30
+#ifndef ART_NET_RAW_UDP
+#ifdef HOST_BUILD
+#define ART_NET_RAW_UDP 0 // the host build has sockets only
+#else
+#define ART_NET_RAW_UDP 1 // receive in the lwIP callback, 0 for BSD sockets
+#endif
+#endif
+#ifndef ART_NET_RAW_QUEUE
+#define ART_NET_RAW_QUEUE 4 // packets other than DMX waiting for the task
+#endif
+
+/*
+ * ArtDmx sequences are tracked per sender IP and universe, modulo 255 (0 disables the check).
+ * A sequence up to SEQUENCE_WINDOW behind the last one is a late or repeated packet and dropped,
+ * anything else is newer. A sender restarted behind its last sequence is taken back after
+ * SEQUENCE_RESYNC packets that follow each other, or after SEQUENCE_TIMEOUT ms of silence.
+ */
+#ifndef SEQUENCE_WINDOW
+#define SEQUENCE_WINDOW 30
 #endif
+#ifndef SEQUENCE_RESYNC
+#define SEQUENCE_RESYNC 3
+#endif
+#ifndef SEQUENCE_TIMEOUT
+#define SEQUENCE_TIMEOUT 2000 /* ms */
+#endif
+#ifndef SEQUENCE_SOURCES
+#define SEQUENCE_SOURCES 4 /* tracked senders, the one silent for longest is replaced */
+#endif
+
+struct art_net_stats {
+    uint32_t frames; // accepted ArtDmx packets for our universe
+    uint32_t late; // dropped as late or repeated
+    uint32_t resyncs; // senders restarted behind their last sequence
+    uint32_t other_universe; // dropped, not for us
+    uint32_t invalid; // dropped, broken ArtDmx header
+};
+
+/* custom opcodes used by timesync.c and probe.c */
+#define ART_NET_TIME_SYNC 0xf82b
+#define ART_NET_PROBE 0xf82d
 
 void init_server();
 
+/**
+ * Handles one received datagram.
+ */
+void parse_art_net(int len, uint8_t* buf);
+
+/**
+ * Sends an Art-Net packet with the opcode and payload to the sender of the packet being parsed.
+ * May be called only from parse_art_net handlers.
+ */
+int art_net_reply(uint16_t opcode, uint8_t* payload, size_t len);
+
+/**
+ * Sends an Art-Net packet with the opcode and payload to ip (network byte order) on ART_NET_PORT.
+ */
+int art_net_send(uint32_t ip, uint16_t opcode, uint8_t* payload, size_t len);
+
+/**
+ * Sends an Art-Net packet with the opcode and payload to ip (network byte order) on port.
+ */
+int art_net_send_to(uint32_t ip, uint16_t port, uint16_t opcode, uint8_t* payload, size_t len);
+
+/**
+ * Returns the sender of the packet being parsed, ip in network byte order.
+ * May be called only from parse_art_net handlers.
+ */
+void art_net_sender(uint32_t *ip, uint16_t *port);
+
+/**
+ * Copies the DMX counters, may be called from any task.
+ */
+void art_net_get_stats(struct art_net_stats *stats);
+
+struct playout;
+
+/**
+ * Returns true if DMX of the universe is shown: the configured universe or, with segments, one a segment takes.
+ */
+bool art_net_universe(uint16_t universe);
+
+/**
+ * Fills out with the universes DMX is shown from, returns their count.
+ */
+int art_net_universes(uint16_t *out, int max);
+
+/**
+ * Shows accepted DMX of a universe, values from channel 1 on: the slice from the DMX Address
+ * or, with segments, every segment taking the universe. Used by the other receivers too,
+ * stream keeps the playout timing of the sender.
+ */
+void art_net_show_dmx(struct playout *stream, uint16_t universe, uint8_t* values, uint16_t length, uint32_t arrival_us);
+
 #endif /* ART_NET_H_ */
@@ -106,7 +106,7 @@ void hsv2rgb(color_HSV*in, ws2812_pixel_t*out)
     }
 }
 
-#ifndef __xtensa__
+#if !defined(__xtensa__) && !defined(HOST_BUILD)
 #include <string.h>
 #include <stdio.h>
 
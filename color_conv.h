@@ -17,6 +17,9 @@ typedef struct {
     uint8_t blue;
     uint8_t green;
     uint8_t red;
+#ifndef I2S_COLOR_PROFILE_RGB
+    uint8_t white;
+#endif
 } ws2812_pixel_t;
 #endif
 
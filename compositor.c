@@ -0,0 +1,65 @@
+/*
+ * compositor.c
+ *
+ * Layer blending, see compositor.h
+ */
+#include "compositor.h"
+#include "pixel_format.h"
+
+// rounded x/255 for x in 0..255*255
+#define div255(x) ((((x) + 128) + (((x) + 128) >> 8)) >> 8)
+
+static inline uint8_t blend_channel(uint8_t dst, uint8_t src, uint8_t mode, uint8_t key) {
+    int v;
+    switch(mode) {
+    case BLEND_ADD:
+        v = dst + src;
+        return v > 255 ? 255 : v;
+    case BLEND_MAX:
+        return dst > src ? dst : src;
+    case BLEND_MULTIPLY:
+        return div255(dst * src);
+    case BLEND_ALPHA:
+        return div255(dst * (255 - key) + src * key);
+    default:
+        return src;
+    }
+}
+
+static inline uint8_t mix(uint8_t a, uint8_t b, uint8_t weight) {
+    return div255(a * (255 - weight) + b * weight);
+}
+
+static inline uint8_t fade(uint8_t a, uint8_t b, uint16_t weight) {
+    return (a * (LAYER_FADE_DONE - weight) + b * weight) >> 8;
+}
+
+#define max3(a, b, c) (((a)>(b))?(((c)>(a))?(c):(a)):((c)>(b))?(c):(b))
+
+void compositor_run(const struct layer *layers, int layers_count, ws2812_pixel_t *out, int count,
+        const uint16_t *map) {
+    for(int i=0;i<count;++i) {
+        uint8_t r = 0, g = 0, b = 0;
+        for(const struct layer *l=layers;l<layers+layers_count;++l) {
+            if(l->opacity == 0 || (!l->solid && i >= l->count)) continue;
+            ws2812_pixel_t src = l->solid ? l->pixels[0] : l->pixels[i];
+            if(l->fade_weight < LAYER_FADE_DONE && l->fade_from) {
+                src.red   = fade(l->fade_from[i].red,   src.red,   l->fade_weight);
+                src.green = fade(l->fade_from[i].green, src.green, l->fade_weight);
+                src.blue  = fade(l->fade_from[i].blue,  src.blue,  l->fade_weight);
+            }
+            uint8_t key = l->blend == BLEND_ALPHA ? max3(src.red, src.green, src.blue) : 0;
+            uint8_t nr = blend_channel(r, src.red,   l->blend, key);
+            uint8_t ng = blend_channel(g, src.green, l->blend, key);
+            uint8_t nb = blend_channel(b, src.blue,  l->blend, key);
+            if(l->opacity == 255) {
+                r = nr; g = ng; b = nb;
+            } else {
+                r = mix(r, nr, l->opacity);
+                g = mix(g, ng, l->opacity);
+                b = mix(b, nb, l->opacity);
+            }
+        }
+        pixel_pack(map ? &out[map[i]] : &out[i], r, g, b);
+    }
+}
@@ -0,0 +1,43 @@
+/*
+ * compositor.h
+ *
+ * Fixed stack of pixel layers blended into the output buffer in one pass.
+ */
+
+#ifndef COMPOSITOR_H_
+#define COMPOSITOR_H_
+
+#include <stdint.h>
+
+#include "color_conv.h"
+
+enum {
+    BLEND_REPLACE = 0,
+    BLEND_ADD,      // saturating sum
+    BLEND_MAX,      // per-channel maximum
+    BLEND_MULTIPLY, // dst * src / 255
+    BLEND_ALPHA,    // luma key: the brightest channel of the source pixel is its alpha
+    BLEND_COUNT
+};
+
+#define LAYER_FADE_DONE 256
+
+struct layer {
+    uint8_t program;    // workmode rendered into pixels
+    uint8_t opacity;    // 0-255
+    uint8_t blend;      // BLEND_*
+    uint8_t solid;      // pixels holds a single color for the whole strip
+    uint16_t count;     // number of pixels covered, counting from the beginning of the strip
+    uint16_t fade_weight; // crossfade from fade_from to pixels, 0..LAYER_FADE_DONE
+    ws2812_pixel_t *pixels;
+    ws2812_pixel_t *fade_from;
+};
+
+/**
+ * Composites the layers bottom to top over black into out, packed in the wire order of the profile.
+ * Logical pixel i is written to out[map[i]], a NULL map keeps the order.
+ */
+void compositor_run(const struct layer *layers, int layers_count, ws2812_pixel_t *out, int count,
+        const uint16_t *map);
+
+#endif /* COMPOSITOR_H_ */
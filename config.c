@@ -0,0 +1,267 @@
+/*
+ * config.c
+ *
+ * Persistent settings blob, see config.h
+ */
+#include "espressif/esp_common.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "event_groups.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "art_net.h"
+#include "monitor.h"
+#include "logger.h"
+#include "sysparam_macros.h"
+
+static const char* TAG = "config";
+
+static const char *config_name = "config";
+
+#define CONFIG_HEADER 8 // VERSION + LENGTH + CRC32
+#define CONFIG_CHANGED_BIT BIT0
+#define DATA_CHANGED_BIT BIT1
+
+struct config config;
+
+static SemaphoreHandle_t config_lock;
+static EventGroupHandle_t config_event_group;
+static const char *pending_name = NULL;
+static uint8_t *pending_data = NULL;
+static size_t pending_len = 0;
+
+enum {
+    LEGACY_INT8,
+    LEGACY_INT32, // into uint16_t
+    LEGACY_STRING,
+};
+
+struct legacy_key {
+    const char *name;
+    uint8_t type;
+    uint8_t offset;
+    uint8_t size;
+};
+
+#define LEGACY(name, type, field) {name, type, offsetof(struct config, field), sizeof(config.field)}
+
+/* Keys used before the blob, in the format of SPTW_* macros */
+static const struct legacy_key legacy_keys[] = {
+    LEGACY("memory_ok_magic", LEGACY_INT8, memory_ok_magic),
+    LEGACY("dmx_universe", LEGACY_INT32, dmx_universe),
+    LEGACY("dmx_shift", LEGACY_INT32, dmx_shift),
+    LEGACY("program_settings.rainbow.delay", LEGACY_INT32, rainbow_delay),
+    LEGACY("program_settings.rainbow.step_time", LEGACY_INT32, rainbow_step_time),
+    LEGACY("program_settings.rainbow.step_length", LEGACY_INT32, rainbow_step_length),
+    LEGACY("program_settings.rainbow.begin.red", LEGACY_INT8, rainbow_begin[0]),
+    LEGACY("program_settings.rainbow.begin.green", LEGACY_INT8, rainbow_begin[1]),
+    LEGACY("program_settings.rainbow.begin.blue", LEGACY_INT8, rainbow_begin[2]),
+    LEGACY("program_settings.rainbow.tint.red", LEGACY_INT8, rainbow_tint[0]),
+    LEGACY("program_settings.rainbow.tint.green", LEGACY_INT8, rainbow_tint[1]),
+    LEGACY("program_settings.rainbow.tint.blue", LEGACY_INT8, rainbow_tint[2]),
+    LEGACY("program_settings.rainbow.tint_level", LEGACY_INT8, rainbow_tint_level),
+    LEGACY("program_settings.rainbow.tint_type", LEGACY_INT8, rainbow_tint_type),
+    LEGACY("cue_count", LEGACY_INT8, cue_count),
+    LEGACY("cue_follow_timecode", LEGACY_INT8, cue_follow_timecode),
+    LEGACY("wifi_ap_always", LEGACY_INT8, wifi_ap_always),
+    LEGACY("wifi_ap_ssid", LEGACY_STRING, wifi_ap_ssid),
+    LEGACY("wifi_ap_pass", LEGACY_STRING, wifi_ap_pass),
+};
+
+uint32_t config_crc32(const uint8_t *data, size_t len) {
+    uint32_t crc = 0xffffffff;
+    while(len--) {
+        crc ^= *(data++);
+        for(int i=0;i<8;++i) crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+void config_reset() {
+    memset(&config, 0, sizeof(config));
+    config.memory_ok_magic = MEMORY_OK_MAGIC;
+    config.dmx_universe = ART_NET_UNIVERSE;
+    config.dmx_shift = ART_NET_SHIFT;
+    config.rainbow_delay = UINT16_MAX; // stopped
+}
+
+static int load_legacy() {
+    int err, ret = 0;
+    int8_t v8;
+    int32_t v32;
+    char *str;
+
+    for(int i=0;i<sizeof(legacy_keys)/sizeof(legacy_keys[0]);++i) {
+        const struct legacy_key *key = &legacy_keys[i];
+        uint8_t *field = (uint8_t*)&config + key->offset;
+        switch(key->type) {
+        case LEGACY_INT8:
+            if((err = sysparam_get_int8(key->name, &v8)) == SYSPARAM_OK) *field = v8;
+            break;
+        case LEGACY_INT32:
+            if((err = sysparam_get_int32(key->name, &v32)) == SYSPARAM_OK) {
+                uint16_t v16 = v32;
+                memcpy(field, &v16, sizeof(v16));
+            }
+            break;
+        default:
+            str = NULL;
+            if((err = sysparam_get_string(key->name, &str)) == SYSPARAM_OK && str) {
+                strncpy((char*)field, str, key->size - 1);
+                field[key->size - 1] = 0;
+            }
+            free(str);
+        }
+        if(err < SYSPARAM_OK) {
+            LOGE("sysparam_get %s failed (%d)", key->name, err);
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+/**
+ * Returns 0 if the blob was loaded, 1 if there is no valid blob.
+ */
+static int load_blob() {
+    uint8_t *buf = NULL;
+    size_t len = 0;
+    bool is_binary;
+    int err, ret = 1;
+
+    if((err = sysparam_get_data(config_name, &buf, &len, &is_binary)) < SYSPARAM_OK) {
+        LOGE("sysparam_get_data %s failed (%d)", config_name, err);
+        return 1;
+    }
+    if(!buf) return 1;
+    if(len >= CONFIG_HEADER) {
+        uint16_t version = buf[0] | (buf[1] << 8);
+        uint16_t data_len = buf[2] | (buf[3] << 8);
+        uint32_t crc = buf[4] | (buf[5] << 8) | (buf[6] << 16) | ((uint32_t)buf[7] << 24);
+        if(version != CONFIG_VERSION) {
+            LOGW("Config version %d is not supported", version);
+        } else if(data_len != len - CONFIG_HEADER || config_crc32(buf + CONFIG_HEADER, data_len) != crc) {
+            LOGE("Config is corrupt");
+        } else {
+            memcpy(&config, buf + CONFIG_HEADER, data_len < sizeof(config) ? data_len : sizeof(config));
+            ret = 0;
+        }
+    }
+    free(buf);
+    return ret;
+}
+
+static void flush_data() {
+    const char *name;
+    uint8_t *data;
+    size_t len;
+    int err;
+
+    if(xSemaphoreTake(config_lock, 1000) != pdTRUE) {
+        LOGE("FAILED TO TAKE LOCK");
+        return;
+    }
+    name = pending_name;
+    data = pending_data;
+    len = pending_len;
+    pending_data = NULL;
+    xSemaphoreGive(config_lock);
+    if(!data) return;
+    if((err = sysparam_set_data(name, data, len, true)) != SYSPARAM_OK) {
+        LOGE("sysparam_set_data %s failed (%d)", name, err);
+    } else {
+        LOGD("Saved %s of %d bytes", name, (int)len);
+    }
+    free(data);
+}
+
+static void config_task(void *pvParameters) {
+    const EventBits_t all = CONFIG_CHANGED_BIT | DATA_CHANGED_BIT;
+    EventBits_t bits, more;
+    while(1) {
+        bits = xEventGroupWaitBits(config_event_group, all, pdTRUE, pdFALSE, portMAX_DELAY);
+        // debounce: write once the changes stop
+        while((more = xEventGroupWaitBits(config_event_group, all, pdTRUE, pdFALSE,
+                CONFIG_WRITE_DELAY / portTICK_PERIOD_MS) & all)) {
+            bits |= more;
+        }
+        if(bits & CONFIG_CHANGED_BIT) config_flush();
+        if(bits & DATA_CHANGED_BIT) flush_data();
+    }
+    vTaskDelete(NULL);
+}
+
+int config_init() {
+    TaskHandle_t task = NULL;
+    int ret = 0;
+
+    config_lock = xSemaphoreCreateMutex();
+    config_event_group = xEventGroupCreate();
+
+    config_reset();
+    config.memory_ok_magic = MEMORY_OK_MAGIC - 1; // a blank memory is cleared
+    if(load_blob() != 0) {
+        LOGI("Migrating settings from separate keys");
+        ret = load_legacy();
+        if(ret == 0 && config.memory_ok_magic == MEMORY_OK_MAGIC) {
+            config_save();
+        }
+    }
+
+    xTaskCreate(config_task, TAG, 256, NULL, 1, &task);
+    monitor_register(task);
+    return ret;
+}
+
+void config_save() {
+    xEventGroupSetBits(config_event_group, CONFIG_CHANGED_BIT);
+}
+
+void config_save_data(const char *name, uint8_t *data, size_t len) {
+    uint8_t *old;
+    if(xSemaphoreTake(config_lock, 1000) != pdTRUE) {
+        LOGE("FAILED TO TAKE LOCK");
+        free(data);
+        return;
+    }
+    old = pending_data;
+    pending_name = name;
+    pending_data = data;
+    pending_len = len;
+    xSemaphoreGive(config_lock);
+    free(old);
+    xEventGroupSetBits(config_event_group, DATA_CHANGED_BIT);
+}
+
+int config_flush() {
+    uint8_t buf[CONFIG_HEADER + sizeof(struct config)];
+    uint32_t crc;
+    int err;
+
+    if(xSemaphoreTake(config_lock, 1000) != pdTRUE) {
+        LOGE("FAILED TO TAKE LOCK");
+        return -1;
+    }
+    // owners don't lock the fields, a value torn by a concurrent change is rewritten by its config_save()
+    memcpy(buf + CONFIG_HEADER, &config, sizeof(config));
+    crc = config_crc32(buf + CONFIG_HEADER, sizeof(config));
+    buf[0] = CONFIG_VERSION & 0xff;
+    buf[1] = CONFIG_VERSION >> 8;
+    buf[2] = sizeof(config) & 0xff;
+    buf[3] = sizeof(config) >> 8;
+    for(int i=0;i<4;++i) buf[4 + i] = crc >> (8 * i);
+    if((err = sysparam_set_data(config_name, buf, sizeof(buf), true)) != SYSPARAM_OK) {
+        LOGE("sysparam_set_data %s failed (%d)", config_name, err);
+        xSemaphoreGive(config_lock);
+        return -2;
+    }
+    xSemaphoreGive(config_lock);
+    LOGD("Saved %d bytes", (int)sizeof(buf));
+    return 0;
+}
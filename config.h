@@ -0,0 +1,81 @@
+/*
+ * config.h
+ *
+ * Persistent settings, kept in RAM and stored as a single sysparam blob:
+ *   VERSION(2) + LENGTH(2) + CRC32(4) + struct config
+ * The blob is read once at boot. If it is missing or broken, the settings are migrated
+ * from the per-setting keys used before. Variable-length data (stations, cues, shader)
+ * keeps its own keys.
+ * Owners change the fields in place and call config_save(), the blob is written
+ * CONFIG_WRITE_DELAY ms after the last change, so bursts of changes cost one flash write.
+ */
+
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef CONFIG_WRITE_DELAY
+#define CONFIG_WRITE_DELAY 2000 /* ms */
+#endif
+
+/* New fields are appended, a shorter blob of the same version gets defaults for them */
+#define CONFIG_VERSION 1
+
+#define CONFIG_AP_SSID_LEN 33
+#define CONFIG_AP_PASS_LEN 65
+
+struct config {
+    int8_t memory_ok_magic;
+    uint16_t dmx_universe;
+    uint16_t dmx_shift;
+    uint16_t rainbow_delay;
+    uint16_t rainbow_step_time;
+    uint16_t rainbow_step_length;
+    uint8_t rainbow_begin[3]; // RGB
+    uint8_t rainbow_tint[3]; // RGB
+    uint8_t rainbow_tint_level;
+    uint8_t rainbow_tint_type;
+    int8_t cue_count;
+    int8_t cue_follow_timecode;
+    int8_t wifi_ap_always;
+    char wifi_ap_ssid[CONFIG_AP_SSID_LEN]; // empty if not set
+    char wifi_ap_pass[CONFIG_AP_PASS_LEN]; // empty if not set
+    uint32_t time_master; // IPv4 in network byte order, 0 if the node keeps its own clock
+    uint16_t playout_budget; // ms of adaptive delay for live frames, 0 shows them as they come
+    uint8_t merge_mode; // MERGE_HTP or MERGE_LTP of two ArtDmx sources, set by ArtAddress
+} __attribute__((packed));
+
+extern struct config config;
+
+/**
+ * Loads the settings, sysparam must be initialized.
+ * Returns 0 on success or negative error code, the defaults are kept on failure.
+ */
+int config_init();
+
+/**
+ * Sets the defaults, the memory magic included.
+ */
+void config_reset();
+
+/**
+ * Schedules the write of the blob.
+ */
+void config_save();
+
+/**
+ * Writes the blob now, returns 0 on success or negative error code.
+ */
+int config_flush();
+
+/**
+ * Schedules a write of variable-length data to its own key along with the blob.
+ * Takes ownership of the malloc'd data. There is one pending write, a new one replaces it.
+ */
+void config_save_data(const char *name, uint8_t *data, size_t len);
+
+uint32_t config_crc32(const uint8_t *data, size_t len);
+
+#endif /* CONFIG_H_ */
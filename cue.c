@@ -0,0 +1,305 @@
+/*
+ * cue.c
+ *
+ * Cue list storage and local playback, see cue.h
+ */
+#include "espressif/esp_common.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "cue.h"
+#include "ws2812.h"
+#include "logger.h"
+#include "sysparam.h"
+#include "config.h"
+
+static const char* TAG = "cue";
+
+#define CUE_HEADER 6 // HOLD + FADE
+
+static SemaphoreHandle_t cue_lock;
+
+static uint8_t cue_count = 0;
+static uint32_t cue_hold[CUE_MAX_CUES];
+static uint16_t cue_fade[CUE_MAX_CUES];
+
+static bool playing = false;
+static bool pending = false; // current cue has to be applied
+static int current = -1;
+static uint32_t cue_begin = 0; // player clock of the current cue start
+
+static int8_t cue_follow_timecode = 0;
+static bool timecode_valid = false;
+static uint32_t timecode_ms = 0, timecode_at = 0;
+
+static void cue_name(char *name, int index) {
+    snprintf(name, 8, "cue_%02d", index);
+}
+
+static uint32_t now_ms() {
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+static uint32_t player_clock() {
+    uint32_t now = now_ms();
+    if(cue_follow_timecode && timecode_valid) {
+        return timecode_ms + (now - timecode_at);
+    }
+    return now;
+}
+
+static int parse_cue(uint8_t *data, size_t len, struct cue *out) {
+    if(len < CUE_HEADER + 1) return -1;
+    out->hold = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+    out->fade = (data[4] << 8) | data[5];
+    out->len = len - CUE_HEADER;
+    out->payload = data + CUE_HEADER;
+    out->data = data;
+    return 0;
+}
+
+static int load_cue(int index, struct cue *out) {
+    char name[8];
+    uint8_t *data = NULL;
+    size_t len = 0;
+    bool is_binary;
+    int err;
+
+    cue_name(name, index);
+    if((err = sysparam_get_data(name, &data, &len, &is_binary)) < SYSPARAM_OK) {
+        LOGE("sysparam_get_data %s failed (%d)", name, err);
+        return -1;
+    }
+    if(!data || parse_cue(data, len, out) != 0) {
+        LOGE("Cue %d is missing or broken", index);
+        free(data);
+        return -2;
+    }
+    return 0;
+}
+
+void cue_free(struct cue *c) {
+    free(c->data);
+    c->data = NULL;
+    c->payload = NULL;
+}
+
+void cue_init() {
+    struct cue c;
+    int8_t count = config.cue_count;
+
+    cue_lock = xSemaphoreCreateMutex();
+
+    cue_follow_timecode = config.cue_follow_timecode;
+    if(count > CUE_MAX_CUES) count = CUE_MAX_CUES;
+    if(count < 0) count = 0;
+
+    for(cue_count = 0; cue_count < count; ++cue_count) {
+        if(load_cue(cue_count, &c) != 0) break;
+        cue_hold[cue_count] = c.hold;
+        cue_fade[cue_count] = c.fade;
+        cue_free(&c);
+    }
+    LOGI("Loaded %d cues, timecode: %d", cue_count, cue_follow_timecode);
+}
+
+int cue_store(uint8_t *buf, size_t len) {
+    char name[8];
+    struct cue c = {0};
+    int err;
+
+    if(len < 1) return -1;
+    uint8_t index = buf[0];
+    if(index > cue_count || index >= CUE_MAX_CUES) {
+        LOGE("Cue index %d is out of range, count: %d", index, cue_count);
+        return -1;
+    }
+    int8_t count = index;
+    if(len == 1) {
+        LOGI("Truncating cue list to %d cues", index);
+    } else {
+        if(parse_cue(buf + 1, len - 1, &c) != 0) {
+            LOGE("Cue is too short");
+            return -2;
+        }
+        cue_name(name, index);
+        if((err = sysparam_set_data(name, buf + 1, len - 1, true)) != SYSPARAM_OK) {
+            LOGE("sysparam_set_data %s failed (%d)", name, err);
+            return -3;
+        }
+        if(index == cue_count) count = index + 1;
+        else count = cue_count;
+    }
+    if(count != cue_count) {
+        config.cue_count = count;
+        config_save();
+    }
+
+    if(xSemaphoreTake(cue_lock, 1000) == pdTRUE) {
+        if(len > 1) {
+            cue_hold[index] = c.hold;
+            cue_fade[index] = c.fade;
+            if(index == current) pending = true;
+        }
+        cue_count = count;
+        if(current >= cue_count) {
+            playing = false;
+            current = -1;
+        }
+        xSemaphoreGive(cue_lock);
+    }else{
+        LOGE("FAILED TO TAKE LOCK");
+        return -4;
+    }
+    IFLOGI(if(len > 1) LOGI("Stored cue %d, hold: %d, fade: %d", index, c.hold, c.fade);)
+    return 0;
+}
+
+int cue_command(uint8_t *buf, size_t len) {
+    if(len < 1) return -1;
+
+    if(xSemaphoreTake(cue_lock, 1000) != pdTRUE) {
+        LOGE("FAILED TO TAKE LOCK");
+        return -4;
+    }
+    switch(buf[0]) {
+    case CUE_STOP:
+        LOGI("Stop");
+        playing = false;
+        break;
+    case CUE_PLAY:
+        current = len > 1 ? buf[1] : 0;
+        if(current >= cue_count) {
+            LOGE("Cue %d doesn't exist, count: %d", current, cue_count);
+            current = -1;
+            playing = false;
+            xSemaphoreGive(cue_lock);
+            return -2;
+        }
+        LOGI("Play from cue %d", current);
+        playing = true;
+        pending = true;
+        cue_begin = player_clock();
+        break;
+    case CUE_TIMECODE:
+        cue_follow_timecode = len > 1 && buf[1];
+        LOGI("Follow timecode: %d", cue_follow_timecode);
+        pending = playing;
+        config.cue_follow_timecode = cue_follow_timecode;
+        config_save();
+        break;
+    default:
+        LOGW("Unknown cue command %d", buf[0]);
+        xSemaphoreGive(cue_lock);
+        return -3;
+    }
+    xSemaphoreGive(cue_lock);
+    ws2812_refresh();
+    return 0;
+}
+
+void cue_stop() {
+    if(xSemaphoreTake(cue_lock, 1000) == pdTRUE) {
+        playing = false;
+        xSemaphoreGive(cue_lock);
+    }else{
+        LOGE("FAILED TO TAKE LOCK");
+    }
+}
+
+bool cue_playing() {
+    return playing;
+}
+
+void cue_timecode(uint32_t tc_ms) {
+    if(xSemaphoreTake(cue_lock, 100) == pdTRUE) {
+        timecode_at = now_ms();
+        timecode_ms = tc_ms;
+        timecode_valid = true;
+        xSemaphoreGive(cue_lock);
+    }else{
+        LOGE("FAILED TO TAKE LOCK");
+    }
+}
+
+/**
+ * Finds the cue at position t of the timeline, where cues follow each other without looping.
+ */
+static int timeline_cue(uint32_t t, uint32_t *begin) {
+    uint32_t start = 0;
+    int i;
+    for(i=0;i<cue_count-1;++i) {
+        uint32_t next = start + cue_fade[i] + cue_hold[i];
+        if(t < next) break;
+        start = next;
+    }
+    *begin = start;
+    return i;
+}
+
+int cue_poll(struct cue *out) {
+    int target, ret = 0;
+    uint32_t t, begin;
+
+    if(!playing) return 0;
+    if(xSemaphoreTake(cue_lock, 100) != pdTRUE) {
+        LOGE("FAILED TO TAKE LOCK");
+        return 0;
+    }
+    t = player_clock();
+    if(!playing || cue_count == 0) {
+        goto end;
+    }
+    if(cue_follow_timecode) {
+        target = timeline_cue(t, &begin);
+    } else {
+        target = current;
+        begin = cue_begin;
+        for(int i=0;i<cue_count && t - begin >= cue_fade[target] + cue_hold[target];++i) {
+            begin += cue_fade[target] + cue_hold[target];
+            target = (target + 1) % cue_count;
+        }
+    }
+    if(target == current && !pending) {
+        goto end;
+    }
+    if(load_cue(target, out) != 0) {
+        playing = false;
+        goto end;
+    }
+    LOGD("Cue %d", target);
+    current = target;
+    cue_begin = begin;
+    pending = false;
+    ret = 1;
+end:
+    xSemaphoreGive(cue_lock);
+    return ret;
+}
+
+int cue_fade_weight() {
+    int c = current;
+    if(!playing || c < 0 || cue_fade[c] == 0) return CUE_FADE_DONE;
+    uint32_t elapsed = player_clock() - cue_begin;
+    if(elapsed >= cue_fade[c]) return CUE_FADE_DONE;
+    return elapsed * CUE_FADE_DONE / cue_fade[c];
+}
+
+uint32_t cue_next_event() {
+    int c = current;
+    if(!playing || c < 0) return UINT32_MAX;
+    if(pending) return 0;
+    uint32_t elapsed = player_clock() - cue_begin;
+    if(elapsed < cue_fade[c]) return CUE_FADE_STEP;
+    if(elapsed >= cue_fade[c] + cue_hold[c]) {
+        // the timeline doesn't loop, after its last cue only a new timecode brings a change
+        return cue_follow_timecode && c == cue_count - 1 ? UINT32_MAX : 0;
+    }
+    return cue_fade[c] + cue_hold[c] - elapsed;
+}
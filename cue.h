@@ -0,0 +1,77 @@
+/*
+ * cue.h
+ *
+ * Flash-resident cue list played locally by ws2812_updater.
+ * Each cue is a WORKMODE + WMPAYLOAD (see README) with hold and fade times.
+ */
+
+#ifndef CUE_H_
+#define CUE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifndef CUE_MAX_CUES
+#define CUE_MAX_CUES 32
+#endif
+
+#ifndef CUE_FADE_STEP
+#define CUE_FADE_STEP 20 /* ms between crossfade frames */
+#endif
+
+#define CUE_FADE_DONE 256
+
+enum {
+    CUE_STOP = 0,
+    CUE_PLAY,
+    CUE_TIMECODE,
+};
+
+struct cue {
+    uint32_t hold; // ms
+    uint16_t fade; // ms
+    uint16_t len;
+    uint8_t *payload; // WORKMODE + WMPAYLOAD
+    uint8_t *data;
+};
+
+void cue_init();
+
+/**
+ * Stores a cue: INDEX + HOLD + FADE + WORKMODE + WMPAYLOAD, or truncates the list if only INDEX is sent.
+ */
+int cue_store(uint8_t *buf, size_t len);
+
+/**
+ * Executes a player command: COMMAND + [ARGUMENT]
+ */
+int cue_command(uint8_t *buf, size_t len);
+
+void cue_stop();
+bool cue_playing();
+
+/**
+ * Feeds ArtTimeCode position, used as the player clock if timecode following is enabled.
+ */
+void cue_timecode(uint32_t timecode_ms);
+
+/**
+ * Returns 1 and loads the cue into out if a new cue has to be applied now, 0 otherwise.
+ * The loaded cue must be released by cue_free.
+ */
+int cue_poll(struct cue *out);
+void cue_free(struct cue *c);
+
+/**
+ * Crossfade weight of the current cue over the previous look, 0..CUE_FADE_DONE.
+ */
+int cue_fade_weight();
+
+/**
+ * Milliseconds until the player needs the next frame, UINT32_MAX if it doesn't,
+ * e.g. past the last cue of the timecode timeline.
+ */
+uint32_t cue_next_event();
+
+#endif /* CUE_H_ */
@@ -11,7 +11,11 @@
 
 #include "ws2812.h"
 #include "art_net.h"
+#include "sacn.h"
 #include "wifi.h"
+#include "monitor.h"
+#include "config.h"
+#include "timesync.h"
 #include "logger.h"
 
 #include "sysparam_macros.h"
@@ -36,8 +40,6 @@ int clean_mem() {
         LOGE("failed to sysparam_create_area (%d)", err);
         return -1;
     }
-    int8_t memory_ok_magic = MEMORY_OK_MAGIC;
-    SPTW_SETR(int8, memory_ok_magic, memory_ok_magic, return -3);
     return 0;
 }
 
@@ -47,6 +49,9 @@ void user_init(void)
     uart_set_baud(0, 115200);
 
     uint32_t base_addr,num_sectors;
+    bool cleaned = false;
+
+    monitor_init();
 
     int err = sysparam_get_info(&base_addr, &num_sectors);
     if (err == SYSPARAM_OK) {
@@ -59,22 +64,34 @@ void user_init(void)
                 LOGE("Cleaning memory failed.");
                 return;
             }
+            cleaned = true;
         }
     }
 
-    int8_t memory_ok_magic = MEMORY_OK_MAGIC-1;
-    SPTW_GETR(int8, memory_ok_magic, memory_ok_magic, return);
-    if(memory_ok_magic != MEMORY_OK_MAGIC) {
-        LOGI("Memory magic mismatched, clearing memory..");
-        if(clean_mem() != 0) {
-            LOGE("Cleaning memory failed.");
+    if(config_init() != 0) {
+        LOGE("Loading settings failed.");
+        return;
+    }
+    if(config.memory_ok_magic != MEMORY_OK_MAGIC) {
+        if(!cleaned) {
+            LOGI("Memory magic mismatched, clearing memory..");
+            if(clean_mem() != 0) {
+                LOGE("Cleaning memory failed.");
+                return;
+            }
+        }
+        config_reset();
+        if(config_flush() != 0) {
+            LOGE("Saving settings failed.");
             return;
         }
     }
 
-
-    wifi_init();
+    // the strip shows the last look while the network comes up
     ws2812_init();
+    wifi_init();
     init_server();
+    init_sacn_server();
+    timesync_init();
     init_osc_server();
 }
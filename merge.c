@@ -0,0 +1,148 @@
+/*
+ * merge.c
+ *
+ * Merge of DMX sources, see merge.h
+ */
+#include <string.h>
+#include <stdbool.h>
+
+#include "merge.h"
+#include "logger.h"
+
+static const char *TAG = "merge";
+
+#define HIGH 0x80808080u
+#define LOW 0x7f7f7f7fu
+
+static struct merge_universe universes[MERGE_UNIVERSES];
+static uint32_t incoming[MERGE_WORDS];
+// the last frame shown unmerged, the merge starts from it when a second source comes
+static struct merge_source shown;
+static uint16_t shown_universe;
+
+/**
+ * 0xff in the bytes of v where the high bit is set, 0 in the others.
+ */
+static inline uint32_t byte_mask(uint32_t v) {
+    return ((v & HIGH) >> 7) * 0xff;
+}
+
+/**
+ * Per byte maximum of a and b.
+ */
+static inline uint32_t bytes_max(uint32_t a, uint32_t b) {
+    // the low 7 bits are compared without borrows between the bytes, the high bits decide where they differ
+    uint32_t low_ge = (a | HIGH) - (b & LOW);
+    uint32_t ge = ((a ^ b) & a) | (~(a ^ b) & low_ge);
+    uint32_t m = byte_mask(ge);
+    return (a & m) | (b & ~m);
+}
+
+/**
+ * 0xff in the bytes that differ between a and b, 0 in the others.
+ */
+static inline uint32_t bytes_changed(uint32_t a, uint32_t b) {
+    uint32_t x = a ^ b;
+    return byte_mask(((x & LOW) + LOW) | x);
+}
+
+static bool silent(const struct merge_source *s, uint32_t now_ms) {
+    return !s->ip || now_ms - s->seen >= MERGE_TIMEOUT;
+}
+
+/**
+ * Returns the entry of the universe, a new one if there is none, or NULL if all are in use.
+ */
+static struct merge_universe *find_universe(uint16_t universe, uint32_t now_ms) {
+    struct merge_universe *u, *slot = NULL;
+    for(u=universes;u<universes+MERGE_UNIVERSES;++u) {
+        if((u->sources[0].ip || u->sources[1].ip) && u->universe == universe) return u;
+        if(!slot && silent(&u->sources[0], now_ms) && silent(&u->sources[1], now_ms)) slot = u;
+    }
+    if(slot) {
+        memset(slot, 0, sizeof(*slot));
+        slot->universe = universe;
+    }
+    return slot;
+}
+
+void merge_shown(uint32_t ip, uint16_t universe, const uint8_t *values, uint16_t length, uint32_t now_ms) {
+    if(length > 512) length = 512;
+    shown.ip = ip;
+    shown.seen = now_ms;
+    shown.length = length;
+    shown_universe = universe;
+    memcpy(shown.frame, values, length);
+}
+
+/**
+ * Takes the last frame shown unmerged as the frame of the other source, if it came from another sender.
+ */
+static void seed(struct merge_universe *u, struct merge_source *other, uint32_t ip, uint32_t now_ms) {
+    if(shown.ip == ip || shown_universe != u->universe || silent(&shown, now_ms)) return;
+    LOGI("Merging %08x into universe %d", shown.ip, u->universe);
+    *other = shown;
+    memset((uint8_t*)other->frame + other->length, 0, sizeof(other->frame) - other->length);
+    memcpy(u->out, other->frame, sizeof(u->out));
+    shown.ip = 0; // taken, later frames of it come merged
+}
+
+int merge_frame(uint8_t mode, uint32_t ip, uint16_t universe, const uint8_t *values, uint16_t length,
+        uint32_t now_ms, uint8_t **out) {
+    struct merge_universe *u;
+    struct merge_source *s, *other;
+    int words;
+
+    if(length > 512) length = 512;
+    if(!(u = find_universe(universe, now_ms))) {
+        LOGW("No room to merge universe %d", universe);
+        return -1;
+    }
+    if(u->sources[0].ip == ip) {
+        s = &u->sources[0];
+    } else if(u->sources[1].ip == ip) {
+        s = &u->sources[1];
+    } else if(silent(&u->sources[0], now_ms)) {
+        s = &u->sources[0];
+    } else if(silent(&u->sources[1], now_ms)) {
+        s = &u->sources[1];
+    } else {
+        LOGD("Third source %08x of universe %d ignored", ip, universe);
+        return 0;
+    }
+    if(s->ip != ip) {
+        LOGI("Merging %08x into universe %d", ip, universe);
+        memset(s, 0, sizeof(*s));
+        s->ip = ip;
+    }
+    other = s == &u->sources[0] ? &u->sources[1] : &u->sources[0];
+    if(silent(other, now_ms)) {
+        other->length = 0; // its last frame no longer counts
+        seed(u, other, ip, now_ms);
+    }
+
+    // the frame is aligned and padded with zeros, so the kernels run over whole words
+    memcpy(incoming, values, length);
+    memset((uint8_t*)incoming + length, 0, sizeof(incoming) - length);
+    u->length = length > other->length ? length : other->length;
+    words = (u->length + 3) / 4;
+    if(mode == MERGE_LTP) {
+        // the channels the source changed take its values, a new source changes all it sends
+        int whole = length / 4;
+        uint32_t part = 0;
+        memset(&part, 0xff, length % 4); // the channels sent of the last word
+        for(int i=0;i<words;++i) {
+            uint32_t m = s->length ? bytes_changed(s->frame[i], incoming[i]) : i < whole ? 0xffffffff : i == whole ? part : 0;
+            u->out[i] = (u->out[i] & ~m) | (incoming[i] & m);
+        }
+    } else if(!other->length) {
+        memcpy(u->out, incoming, words * 4);
+    } else {
+        for(int i=0;i<words;++i) u->out[i] = bytes_max(incoming[i], other->frame[i]);
+    }
+    memcpy(s->frame, incoming, sizeof(s->frame));
+    s->length = length;
+    s->seen = now_ms;
+    *out = (uint8_t*)u->out;
+    return u->length;
+}
@@ -0,0 +1,59 @@
+/*
+ * merge.h
+ *
+ * Merge of two sources sending DMX to the same universe, as Art-Net nodes do: the last frame of each
+ * source is kept and every frame of either is merged with the other one, HTP takes the highest value
+ * of every channel, LTP the value changed last. A third source of a merged universe is ignored until
+ * one of the two is silent for MERGE_TIMEOUT ms.
+ * The merge runs a word at a time over the frames. It makes no SDK calls, so it runs in the host build too.
+ */
+
+#ifndef MERGE_H_
+#define MERGE_H_
+
+#include <stdint.h>
+
+#ifndef MERGE_TIMEOUT
+#define MERGE_TIMEOUT 3000 /* ms, a source silent this long is no longer merged */
+#endif
+
+#ifndef MERGE_UNIVERSES
+#define MERGE_UNIVERSES 1 /* universes merged at the same time, 1.5 KB each */
+#endif
+
+#define MERGE_WORDS (512 / 4)
+
+enum {
+    MERGE_HTP = 0,
+    MERGE_LTP,
+};
+
+struct merge_source {
+    uint32_t ip;
+    uint32_t seen;    // ms
+    uint16_t length;  // 0 before the first frame
+    uint32_t frame[MERGE_WORDS];
+};
+
+struct merge_universe {
+    uint16_t universe;
+    uint16_t length;
+    struct merge_source sources[2];
+    uint32_t out[MERGE_WORDS];
+};
+
+/**
+ * Records the frame of a source shown without merging, the merge starts from it
+ * when a second source sends to the universe within MERGE_TIMEOUT ms.
+ */
+void merge_shown(uint32_t ip, uint16_t universe, const uint8_t *values, uint16_t length, uint32_t now_ms);
+
+/**
+ * Merges the frame of a source into the universe, now_ms is the arrival time in ms.
+ * Returns the length of the merged frame and sets *out to it, 0 if the frame is dropped,
+ * it comes from a third source, or negative error code if no more universes can be merged.
+ */
+int merge_frame(uint8_t mode, uint32_t ip, uint16_t universe, const uint8_t *values, uint16_t length,
+        uint32_t now_ms, uint8_t **out);
+
+#endif /* MERGE_H_ */
@@ -0,0 +1,121 @@
+/*
+ * monitor.c
+ *
+ * Stack and heap instrumentation, see monitor.h
+ */
+#include "espressif/esp_common.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "monitor.h"
+#include "logger.h"
+
+static const char* TAG = "monitor";
+
+struct task_info {
+    TaskHandle_t handle;
+    char name[MONITOR_TASK_NAME];
+    uint16_t stack_free; // words, high-water mark
+    uint16_t stack_logged;
+};
+
+static SemaphoreHandle_t monitor_lock;
+static struct task_info tasks[MONITOR_MAX_TASKS];
+static int tasks_count = 0;
+static uint32_t heap_free = 0, heap_min = UINT32_MAX, heap_min_logged = UINT32_MAX;
+static uint32_t first_light_us = 0;
+
+void monitor_register(TaskHandle_t task) {
+    if(!task) return;
+    if(xSemaphoreTake(monitor_lock, 1000) != pdTRUE) {
+        LOGE("FAILED TO TAKE LOCK");
+        return;
+    }
+    if(tasks_count < MONITOR_MAX_TASKS) {
+        struct task_info *t = &tasks[tasks_count++];
+        t->handle = task;
+        strncpy(t->name, pcTaskGetName(task), MONITOR_TASK_NAME);
+        t->stack_free = t->stack_logged = uxTaskGetStackHighWaterMark(task);
+    } else {
+        LOGW("Too many tasks, %s is not monitored", pcTaskGetName(task));
+    }
+    xSemaphoreGive(monitor_lock);
+}
+
+static void sample() {
+    // only counters are read, probing the heap with allocations would starve the network while it runs
+    uint32_t free_now = xPortGetFreeHeapSize();
+
+    if(xSemaphoreTake(monitor_lock, 1000) != pdTRUE) {
+        LOGE("FAILED TO TAKE LOCK");
+        return;
+    }
+    heap_free = free_now;
+    if(free_now < heap_min) heap_min = free_now;
+    if(heap_min + MONITOR_HEAP_THRESHOLD <= heap_min_logged) {
+        LOGI("Heap free: %d, min: %d", heap_free, heap_min);
+        heap_min_logged = heap_min;
+    }
+    for(int i=0;i<tasks_count;++i) {
+        struct task_info *t = &tasks[i];
+        t->stack_free = uxTaskGetStackHighWaterMark(t->handle);
+        if(t->stack_free + MONITOR_STACK_THRESHOLD <= t->stack_logged) {
+            LOGI("Task %s stack headroom: %d words", t->name, t->stack_free);
+            t->stack_logged = t->stack_free;
+        }
+    }
+    xSemaphoreGive(monitor_lock);
+}
+
+static void monitor_task(void *pvParameters) {
+    while(1) {
+        sample();
+        vTaskDelay(MONITOR_PERIOD / portTICK_PERIOD_MS);
+    }
+    vTaskDelete(NULL);
+}
+
+static uint8_t *put_be(uint8_t *p, uint32_t v, int n) {
+    for(int i=n-1;i>=0;--i, v>>=8) p[i] = v & 0xff;
+    return p + n;
+}
+
+int monitor_report(uint8_t *buf, size_t len) {
+    uint8_t *p = buf;
+    if(xSemaphoreTake(monitor_lock, 100) != pdTRUE) {
+        LOGE("FAILED TO TAKE LOCK");
+        return -1;
+    }
+    if(len < 13 + tasks_count * (MONITOR_TASK_NAME + 2)) {
+        xSemaphoreGive(monitor_lock);
+        return -1;
+    }
+    p = put_be(p, heap_free, 4);
+    p = put_be(p, heap_min, 4);
+    *(p++) = tasks_count;
+    for(int i=0;i<tasks_count;++i) {
+        memset(p, 0, MONITOR_TASK_NAME);
+        memcpy(p, tasks[i].name, strnlen(tasks[i].name, MONITOR_TASK_NAME));
+        p = put_be(p + MONITOR_TASK_NAME, tasks[i].stack_free, 2);
+    }
+    p = put_be(p, first_light_us, 4);
+    xSemaphoreGive(monitor_lock);
+    return p - buf;
+}
+
+void monitor_first_light(uint32_t us) {
+    first_light_us = us;
+    LOGI("First light %d ms after boot", us / 1000);
+}
+
+void monitor_init() {
+    TaskHandle_t task = NULL;
+    monitor_lock = xSemaphoreCreateMutex();
+    xTaskCreate(monitor_task, TAG, 512, NULL, 1, &task);
+    monitor_register(task);
+}
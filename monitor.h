@@ -0,0 +1,49 @@
+/*
+ * monitor.h
+ *
+ * Periodic sampling of task stack high-water marks and heap usage.
+ * Tasks are registered by the modules creating them.
+ */
+
+#ifndef MONITOR_H_
+#define MONITOR_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#ifndef MONITOR_PERIOD
+#define MONITOR_PERIOD 5000 /* ms between samples */
+#endif
+
+#ifndef MONITOR_MAX_TASKS
+#define MONITOR_MAX_TASKS 8
+#endif
+
+#ifndef MONITOR_STACK_THRESHOLD
+#define MONITOR_STACK_THRESHOLD 16 /* words of stack headroom lost before it is logged */
+#endif
+
+#ifndef MONITOR_HEAP_THRESHOLD
+#define MONITOR_HEAP_THRESHOLD 1024 /* bytes of minimum free heap lost before it is logged */
+#endif
+
+#define MONITOR_TASK_NAME 8
+
+void monitor_init();
+void monitor_register(TaskHandle_t task);
+
+/**
+ * Records the time of the first frame sent to the strip, us since boot.
+ */
+void monitor_first_light(uint32_t us);
+
+/**
+ * Fills the report of the last sample, see README for the format.
+ * Returns its length or -1 if buf is too small.
+ */
+int monitor_report(uint8_t *buf, size_t len);
+
+#endif /* MONITOR_H_ */
@@ -0,0 +1,76 @@
+/*
+ * pixel_format.h
+ *
+ * Build-time pixel format of the strip: the color order on the wire and the white channel.
+ * The compositor works in RGB and hands every composited pixel to pixel_pack, which is specialized
+ * for the profile at compile time, so the strip variant costs no per-pixel branch.
+ * The driver sends the fields of ws2812_pixel_t as green, red, blue [, white], the order of WS2812B
+ * and SK6812, the packers place the channels into these slots in the order the strip expects.
+ * RGBW profiles need ws2812_pixel_t with white: build without I2S_COLOR_PROFILE_RGB.
+ */
+
+#ifndef PIXEL_FORMAT_H_
+#define PIXEL_FORMAT_H_
+
+#include <stdint.h>
+
+#include "color_conv.h"
+
+#define WS2812_PROFILE_GRB  0 /* WS2812B, WS2813 */
+#define WS2812_PROFILE_RGB  1 /* WS2811 ICs, some 12 V strips */
+#define WS2812_PROFILE_BRG  2 /* some WS2811 and APA106 */
+#define WS2812_PROFILE_GRBW 3 /* SK6812 RGBW */
+#define WS2812_PROFILE_RGBW 4 /* SK6812 RGBW with red first */
+
+#ifndef WS2812_PROFILE
+    #define WS2812_PROFILE WS2812_PROFILE_GRB
+#endif
+
+#if WS2812_PROFILE == WS2812_PROFILE_GRBW || WS2812_PROFILE == WS2812_PROFILE_RGBW
+    #define WS2812_PIXEL_TYPE PIXEL_RGBW
+    #define WS2812_PIXEL_BITS 32
+    #ifdef I2S_COLOR_PROFILE_RGB
+        #error "RGBW profiles need ws2812_pixel_t with white, build without I2S_COLOR_PROFILE_RGB"
+    #endif
+#else
+    #define WS2812_PIXEL_TYPE PIXEL_RGB
+    #define WS2812_PIXEL_BITS 24
+#endif
+
+#define min3(a, b, c) (((a)<(b))?(((c)<(a))?(c):(a)):((c)<(b))?(c):(b))
+
+/**
+ * Writes the RGB color into the driver slots in the wire order of the profile.
+ * RGBW takes the common part of the three channels as white and leaves the rest to the colors.
+ */
+static inline void pixel_pack(ws2812_pixel_t *o, uint8_t r, uint8_t g, uint8_t b) {
+#if WS2812_PROFILE == WS2812_PROFILE_GRB
+    o->green = g;
+    o->red = r;
+    o->blue = b;
+#elif WS2812_PROFILE == WS2812_PROFILE_RGB
+    o->green = r;
+    o->red = g;
+    o->blue = b;
+#elif WS2812_PROFILE == WS2812_PROFILE_BRG
+    o->green = b;
+    o->red = r;
+    o->blue = g;
+#elif WS2812_PROFILE == WS2812_PROFILE_GRBW
+    uint8_t w = min3(r, g, b);
+    o->green = g - w;
+    o->red = r - w;
+    o->blue = b - w;
+    o->white = w;
+#elif WS2812_PROFILE == WS2812_PROFILE_RGBW
+    uint8_t w = min3(r, g, b);
+    o->green = r - w;
+    o->red = g - w;
+    o->blue = b - w;
+    o->white = w;
+#else
+    #error "Unknown WS2812_PROFILE"
+#endif
+}
+
+#endif /* PIXEL_FORMAT_H_ */
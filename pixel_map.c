@@ -0,0 +1,95 @@
+/*
+ * pixel_map.c
+ *
+ * Pixel mapping, see pixel_map.h
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "pixel_map.h"
+#include "logger.h"
+
+static const char *TAG = "pixel_map";
+
+static inline uint16_t get_be16(const uint8_t *p) {
+    return p[0] << 8 | p[1];
+}
+
+/**
+ * Returns the length of the descriptor at desc, or negative error code if it is broken.
+ */
+static int descriptor_len(const uint8_t *desc, size_t len, int count) {
+    switch(desc[0]) {
+    case MAP_NONE:
+    case MAP_REVERSE:
+        return 1;
+    case MAP_SERPENTINE:
+        if(len < 5) return -1;
+        if(!get_be16(desc + 1) || get_be16(desc + 1) * get_be16(desc + 3) > count) return -2;
+        return 5;
+    case MAP_OFFSET:
+        if(len < 3) return -1;
+        return 3;
+    case MAP_TABLE:
+        if(len < 3 || len < 3 + 2 * (size_t)get_be16(desc + 1)) return -1;
+        if(get_be16(desc + 1) > count) return -2;
+        for(int i=0;i<get_be16(desc + 1);++i) {
+            if(get_be16(desc + 3 + 2 * i) >= count) return -2;
+        }
+        return 3 + 2 * get_be16(desc + 1);
+    default:
+        return -3;
+    }
+}
+
+static uint16_t map_one(const uint8_t *desc, uint16_t p, int count) {
+    uint16_t width, row, col;
+    switch(desc[0]) {
+    case MAP_REVERSE:
+        return count - 1 - p;
+    case MAP_SERPENTINE:
+        width = get_be16(desc + 1);
+        if(p >= width * get_be16(desc + 3)) return p;
+        row = p / width;
+        col = p % width;
+        return row & 1 ? row * width + width - 1 - col : p;
+    case MAP_OFFSET:
+        return (p + get_be16(desc + 1)) % count;
+    case MAP_TABLE:
+        return p < get_be16(desc + 1) ? get_be16(desc + 3 + 2 * p) : p;
+    default:
+        return p;
+    }
+}
+
+int pixel_map_build(uint16_t *map, int count, const uint8_t *desc, size_t len) {
+    const uint8_t *d;
+    uint8_t *used;
+    int dlen, ret = 1;
+
+    if(count < 1) return -1;
+    // every descriptor is checked before the map is touched
+    for(d=desc;d<desc+len;d+=dlen) {
+        if((dlen = descriptor_len(d, desc + len - d, count)) < 0) {
+            LOGE("Broken descriptor %d at %d (%d)", d[0], (int)(d - desc), dlen);
+            return -1;
+        }
+    }
+    for(int i=0;i<count;++i) map[i] = i;
+    for(d=desc;d<desc+len;d+=descriptor_len(d, desc + len - d, count)) {
+        for(int i=0;i<count;++i) map[i] = map_one(d, map[i], count);
+    }
+
+    if(!(used = calloc((count + 7) / 8, 1))) return -2;
+    for(int i=0;i<count;++i) {
+        if(used[map[i] / 8] & (1 << (map[i] % 8))) {
+            LOGE("Led %d is mapped twice", map[i]);
+            ret = -3;
+            break;
+        }
+        used[map[i] / 8] |= 1 << (map[i] % 8);
+        if(map[i] != i) ret = 0;
+    }
+    free(used);
+    return ret;
+}
@@ -0,0 +1,33 @@
+/*
+ * pixel_map.h
+ *
+ * Mapping of logical pixels, in the order frames are sent, to physical leds, in the order of the wiring.
+ * The map is built from descriptors applied one after another to the logical index,
+ * e.g. a serpentine matrix mounted reversed is MAP_SERPENTINE followed by MAP_REVERSE.
+ * The compositor writes every pixel through the map, so remapping costs no extra pass.
+ */
+
+#ifndef PIXEL_MAP_H_
+#define PIXEL_MAP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* descriptors, numbers are big-endian */
+enum {
+    MAP_NONE = 0,   // no arguments, keeps the order
+    MAP_REVERSE,    // no arguments, the last led first
+    MAP_SERPENTINE, // + WIDTH(2) + HEIGHT(2), rows of WIDTH leds, every second row wired backwards
+    MAP_OFFSET,     // + OFFSET(2), led i is at i + OFFSET, wrapping around the strip
+    MAP_TABLE,      // + COUNT(2) + COUNT * LED(2), explicit leds of the first COUNT pixels
+    MAP_COUNT
+};
+
+/**
+ * Builds map[logical] = physical for count leds from the descriptors.
+ * Returns 1 if the map keeps the order, 0 otherwise, or negative error code if the descriptors
+ * are broken or don't map every pixel to a led of its own.
+ */
+int pixel_map_build(uint16_t *map, int count, const uint8_t *desc, size_t len);
+
+#endif /* PIXEL_MAP_H_ */
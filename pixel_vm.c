@@ -0,0 +1,227 @@
+/*
+ * pixel_vm.c
+ *
+ * Bytecode validator and interpreter for uploadable pixel effects, see pixel_vm.h
+ */
+#include "pixel_vm.h"
+#include <string.h>
+
+#include "logger.h"
+
+static const char* TAG = "pixel_vm";
+
+#define FLAG_IMM8   0x01
+#define FLAG_IMM16  0x02
+#define FLAG_PIXEL  0x04 // allowed in pixel section only
+#define FLAG_FRAME  0x08 // allowed in frame section only
+#define FLAG_REG    0x10 // immediate is a register index
+#define FLAG_PARAM  0x20 // immediate is a param index
+
+struct op_info {
+    uint8_t pops;
+    uint8_t pushes;
+    uint8_t flags;
+};
+
+static const struct op_info op_table[PVM_OP_COUNT] = {
+    [PVM_END]     = {0, 0, FLAG_FRAME},
+    [PVM_PUSH8]   = {0, 1, FLAG_IMM8},
+    [PVM_PUSH16]  = {0, 1, FLAG_IMM16},
+    [PVM_INDEX]   = {0, 1, FLAG_PIXEL},
+    [PVM_TIME]    = {0, 1, 0},
+    [PVM_COUNT]   = {0, 1, 0},
+    [PVM_PARAM]   = {0, 1, FLAG_IMM8|FLAG_PARAM},
+    [PVM_LOAD]    = {0, 1, FLAG_IMM8|FLAG_REG},
+    [PVM_STORE]   = {1, 0, FLAG_IMM8|FLAG_REG|FLAG_FRAME},
+    [PVM_DUP]     = {1, 2, 0},
+    [PVM_SWAP]    = {2, 2, 0},
+    [PVM_DROP]    = {1, 0, 0},
+    [PVM_ADD]     = {2, 1, 0},
+    [PVM_SUB]     = {2, 1, 0},
+    [PVM_MUL]     = {2, 1, 0},
+    [PVM_DIV]     = {2, 1, 0},
+    [PVM_MOD]     = {2, 1, 0},
+    [PVM_AND]     = {2, 1, 0},
+    [PVM_OR]      = {2, 1, 0},
+    [PVM_XOR]     = {2, 1, 0},
+    [PVM_SHL]     = {2, 1, 0},
+    [PVM_SHR]     = {2, 1, 0},
+    [PVM_MIN]     = {2, 1, 0},
+    [PVM_MAX]     = {2, 1, 0},
+    [PVM_SIN8]    = {1, 1, 0},
+    [PVM_SCALE8]  = {2, 1, 0},
+    [PVM_HSV]     = {3, 3, 0},
+};
+
+int pixel_vm_load(struct pixel_vm_program *prog, const uint8_t *code, size_t len) {
+    size_t pc = 0, pixel_start = 0;
+    int depth = 0, in_pixel = 0;
+
+    if(len < 1 || len > PIXEL_VM_MAX_CODE) {
+        LOGE("Program length %d is out of range", (int)len);
+        return -1;
+    }
+    while(pc < len) {
+        uint8_t op = code[pc];
+        if(op >= PVM_OP_COUNT) {
+            LOGE("Unknown opcode %02x at %d", op, (int)pc);
+            return -2;
+        }
+        const struct op_info *info = &op_table[op];
+        if((info->flags & FLAG_PIXEL) && !in_pixel) {
+            LOGE("Opcode %02x at %d is allowed only in pixel section", op, (int)pc);
+            return -3;
+        }
+        if((info->flags & FLAG_FRAME) && in_pixel) {
+            LOGE("Opcode %02x at %d is allowed only in frame section", op, (int)pc);
+            return -3;
+        }
+        if(depth < info->pops) {
+            LOGE("Stack underflow at %d", (int)pc);
+            return -4;
+        }
+        depth += info->pushes - info->pops;
+        if(depth > PIXEL_VM_STACK) {
+            LOGE("Stack overflow at %d", (int)pc);
+            return -4;
+        }
+        ++pc;
+        if(info->flags & (FLAG_IMM8|FLAG_IMM16)) {
+            size_t imm_len = (info->flags & FLAG_IMM16) ? 2 : 1;
+            if(pc + imm_len > len) {
+                LOGE("Truncated immediate of opcode %02x", op);
+                return -5;
+            }
+            if(((info->flags & FLAG_REG) && code[pc] >= PIXEL_VM_REGISTERS) ||
+                    ((info->flags & FLAG_PARAM) && code[pc] >= PIXEL_VM_PARAMS)) {
+                LOGE("Index %d of opcode %02x is out of range", code[pc], op);
+                return -5;
+            }
+            pc += imm_len;
+        }
+        if(op == PVM_END) {
+            if(depth != 0) {
+                LOGE("Frame section leaves %d values on stack", depth);
+                return -6;
+            }
+            in_pixel = 1;
+            pixel_start = pc;
+        }
+    }
+    if(!in_pixel) {
+        LOGE("No frame section end found");
+        return -6;
+    }
+    if(depth != 3) {
+        LOGE("Pixel section must leave 3 values on stack, got %d", depth);
+        return -6;
+    }
+
+    memcpy(prog->code, code, len);
+    prog->len = len;
+    prog->pixel_start = pixel_start;
+    LOGD("Loaded program of %d bytes, pixel section at %d", (int)len, (int)pixel_start);
+    return 0;
+}
+
+static const uint8_t sin_quarter[65] = {
+    0, 3, 6, 9, 12, 16, 19, 22, 25, 28, 31, 34, 37, 40, 43, 46, 49, 51, 54, 57, 60, 63, 65, 68, 71, 73,
+    76, 78, 81, 83, 85, 88, 90, 92, 94, 96, 98, 100, 102, 104, 106, 107, 109, 111, 112, 113, 115, 116,
+    117, 118, 120, 121, 122, 122, 123, 124, 125, 125, 126, 126, 126, 127, 127, 127, 127
+};
+
+static inline int32_t sin8(int32_t x) {
+    uint8_t i = x & 63;
+    switch((x >> 6) & 3) {
+    case 0: return 128 + sin_quarter[i];
+    case 1: return 128 + sin_quarter[64 - i];
+    case 2: return 128 - sin_quarter[i];
+    default: return 128 - sin_quarter[64 - i];
+    }
+}
+
+#define clip8(a) ((a)>255?255:(a)<0?0:(a))
+
+static inline void hsv8(int32_t *sp) {
+    int32_t h = sp[0] % 360, s = clip8(sp[1]), v = clip8(sp[2]);
+    if(h < 0) h += 360;
+    int32_t region = h / 60;
+    int32_t rem = (h - region * 60) * 255 / 60;
+    int32_t p = (v * (255 - s)) >> 8;
+    int32_t q = (v * (255 - ((s * rem) >> 8))) >> 8;
+    int32_t t = (v * (255 - ((s * (255 - rem)) >> 8))) >> 8;
+
+    switch(region) {
+    case 0:  sp[0] = v; sp[1] = t; sp[2] = p; break;
+    case 1:  sp[0] = q; sp[1] = v; sp[2] = p; break;
+    case 2:  sp[0] = p; sp[1] = v; sp[2] = t; break;
+    case 3:  sp[0] = p; sp[1] = q; sp[2] = v; break;
+    case 4:  sp[0] = t; sp[1] = p; sp[2] = v; break;
+    default: sp[0] = v; sp[1] = p; sp[2] = q; break;
+    }
+}
+
+/**
+ * Executes code in [pc, end), the stack grows upwards from sp.
+ * All the bounds were checked by pixel_vm_load, so there are no checks here.
+ */
+static inline __attribute__((always_inline)) void exec(const uint8_t *pc, const uint8_t *end,
+        int32_t *sp, int32_t index, const struct pixel_vm_state *state, int32_t *regs) {
+    int32_t a;
+    while(pc < end) {
+        switch(*(pc++)) {
+        case PVM_PUSH8:  *(sp++) = *(pc++); break;
+        case PVM_PUSH16: *(sp++) = (int16_t)((pc[0] << 8) | pc[1]); pc += 2; break;
+        case PVM_INDEX:  *(sp++) = index; break;
+        case PVM_TIME:   *(sp++) = state->time; break;
+        case PVM_COUNT:  *(sp++) = state->count; break;
+        case PVM_PARAM:  *(sp++) = state->params[*(pc++)]; break;
+        case PVM_LOAD:   *(sp++) = regs[*(pc++)]; break;
+        case PVM_STORE:  regs[*(pc++)] = *(--sp); break;
+        case PVM_DUP:    *sp = sp[-1]; ++sp; break;
+        case PVM_SWAP:   a = sp[-1]; sp[-1] = sp[-2]; sp[-2] = a; break;
+        case PVM_DROP:   --sp; break;
+        // wrapping arithmetic, uploaded bytecode must not hit signed overflow
+        case PVM_ADD:    --sp; sp[-1] = (uint32_t)sp[-1] + (uint32_t)*sp; break;
+        case PVM_SUB:    --sp; sp[-1] = (uint32_t)sp[-1] - (uint32_t)*sp; break;
+        case PVM_MUL:    --sp; sp[-1] = (uint32_t)sp[-1] * (uint32_t)*sp; break;
+        case PVM_DIV:    --sp; sp[-1] = !*sp ? 0 : *sp == -1 ? -(uint32_t)sp[-1] : sp[-1] / *sp; break;
+        case PVM_MOD:    --sp; sp[-1] = !*sp || *sp == -1 ? 0 : sp[-1] % *sp; break;
+        case PVM_AND:    --sp; sp[-1] &= *sp; break;
+        case PVM_OR:     --sp; sp[-1] |= *sp; break;
+        case PVM_XOR:    --sp; sp[-1] ^= *sp; break;
+        case PVM_SHL:    --sp; sp[-1] = (uint32_t)sp[-1] << (*sp & 31); break;
+        case PVM_SHR:    --sp; sp[-1] >>= (*sp & 31); break;
+        case PVM_MIN:    --sp; if(*sp < sp[-1]) sp[-1] = *sp; break;
+        case PVM_MAX:    --sp; if(*sp > sp[-1]) sp[-1] = *sp; break;
+        case PVM_SIN8:   sp[-1] = sin8(sp[-1]); break;
+        case PVM_SCALE8: --sp; sp[-1] = (int32_t)((uint32_t)sp[-1] * (uint32_t)*sp) >> 8; break;
+        case PVM_HSV:    hsv8(sp - 3); break;
+        default: break; // PVM_END
+        }
+    }
+}
+
+void pixel_vm_frame(const struct pixel_vm_program *prog, struct pixel_vm_state *state,
+        uint32_t time_ms, int count) {
+    int32_t stack[PIXEL_VM_STACK];
+
+    state->time = time_ms;
+    state->count = count;
+    exec(prog->code, prog->code + prog->pixel_start, stack, 0, state, state->regs);
+}
+
+void pixel_vm_render(const struct pixel_vm_program *prog, const struct pixel_vm_state *state,
+        ws2812_pixel_t *pixels, int count) {
+    int32_t stack[PIXEL_VM_STACK];
+    int32_t regs[PIXEL_VM_REGISTERS];
+    const uint8_t *begin = prog->code + prog->pixel_start, *end = prog->code + prog->len;
+
+    memcpy(regs, state->regs, sizeof(regs));
+    for(int i=0;i<count;++i) {
+        exec(begin, end, stack, i, state, regs);
+        pixels[i].red   = clip8(stack[0]);
+        pixels[i].green = clip8(stack[1]);
+        pixels[i].blue  = clip8(stack[2]);
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * pixel_vm.h
+ *
+ * Tiny stack machine computing a pixel color from (index, time, params).
+ * A program consists of two sections:
+ *   FRAME_CODE + END + PIXEL_CODE
+ * FRAME_CODE runs once per frame and may only fill registers (loop invariants),
+ * PIXEL_CODE runs for every pixel and must leave RED, GREEN, BLUE on the stack.
+ * Programs are validated once by pixel_vm_load(), so the interpreter itself runs without checks.
+ */
+
+#ifndef PIXEL_VM_H_
+#define PIXEL_VM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "color_conv.h"
+
+#ifndef PIXEL_VM_MAX_CODE
+#define PIXEL_VM_MAX_CODE 128
+#endif
+
+#ifndef PIXEL_VM_STACK
+#define PIXEL_VM_STACK 16
+#endif
+
+#define PIXEL_VM_REGISTERS 8
+#define PIXEL_VM_PARAMS 8
+
+enum {
+    PVM_END = 0,    // end of the frame section
+    PVM_PUSH8,      // + unsigned byte
+    PVM_PUSH16,     // + big-endian int16
+    PVM_INDEX,      // pixel index, pixel section only
+    PVM_TIME,       // ms since the program start
+    PVM_COUNT,      // number of pixels
+    PVM_PARAM,      // + param index
+    PVM_LOAD,       // + register index
+    PVM_STORE,      // + register index, frame section only
+    PVM_DUP,
+    PVM_SWAP,
+    PVM_DROP,
+    PVM_ADD,
+    PVM_SUB,
+    PVM_MUL,
+    PVM_DIV,        // division by zero yields 0
+    PVM_MOD,        // modulo by zero yields 0
+    PVM_AND,
+    PVM_OR,
+    PVM_XOR,
+    PVM_SHL,
+    PVM_SHR,
+    PVM_MIN,
+    PVM_MAX,
+    PVM_SIN8,       // x -> 128+127*sin(2*pi*x/256)
+    PVM_SCALE8,     // a b -> a*b/256
+    PVM_HSV,        // h(0-359) s(0-255) v(0-255) -> r g b
+    PVM_OP_COUNT
+};
+
+struct pixel_vm_program {
+    uint8_t len;
+    uint8_t pixel_start; // offset of the pixel section
+    uint8_t code[PIXEL_VM_MAX_CODE];
+};
+
+struct pixel_vm_state {
+    int32_t time;
+    int32_t count;
+    int32_t params[PIXEL_VM_PARAMS];
+    int32_t regs[PIXEL_VM_REGISTERS];
+};
+
+/**
+ * Validates the bytecode and copies it into the program.
+ * Returns 0 on success or negative error code, the program is untouched on failure.
+ */
+int pixel_vm_load(struct pixel_vm_program *prog, const uint8_t *code, size_t len);
+
+/**
+ * Precomputes per-frame invariants: sets time, count and runs the frame section.
+ */
+void pixel_vm_frame(const struct pixel_vm_program *prog, struct pixel_vm_state *state,
+        uint32_t time_ms, int count);
+
+/**
+ * Runs the pixel section for each of the count pixels.
+ */
+void pixel_vm_render(const struct pixel_vm_program *prog, const struct pixel_vm_state *state,
+        ws2812_pixel_t *pixels, int count);
+
+#endif /* PIXEL_VM_H_ */
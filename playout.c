@@ -0,0 +1,41 @@
+/*
+ * playout.c
+ *
+ * Adaptive playout delay, see playout.h
+ */
+#include <stdlib.h>
+
+#include "playout.h"
+#include "logger.h"
+
+IFLOGV(static const char *TAG = "playout";)
+
+uint32_t playout_due(struct playout *p, uint32_t arrival_us, uint32_t budget_us) {
+    int32_t gap = arrival_us - p->last_arrival, deviation, error;
+    uint32_t target, due;
+
+    if(!p->started || gap > PLAYOUT_RESET * 1000 || gap < 0) {
+        *p = (struct playout){.started = true, .last_arrival = arrival_us, .last_due = arrival_us};
+        return arrival_us;
+    }
+    p->last_arrival = arrival_us;
+    if(!p->period) {
+        p->period = gap;
+    } else {
+        deviation = gap - (int32_t)p->period;
+        p->jitter += (abs(deviation) - (int32_t)p->jitter) / 16;
+        p->period += deviation / 16;
+    }
+
+    target = PLAYOUT_JITTER_FACTOR * p->jitter;
+    if(target > budget_us) target = budget_us;
+    // steady cadence, corrected by an eighth of the error so that jitter doesn't pass through
+    due = p->last_due + p->period;
+    error = arrival_us + target - due;
+    due += error / 8;
+    if((int32_t)(due - arrival_us) < 0) due = arrival_us; // late, at once
+    if(due - arrival_us > budget_us) due = arrival_us + budget_us;
+    p->last_due = due;
+    LOGV("Period %d us, jitter %d us, delay %d us", p->period, p->jitter, due - arrival_us);
+    return due;
+}
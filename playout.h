@@ -0,0 +1,42 @@
+/*
+ * playout.h
+ *
+ * Adaptive playout delay for live frames that carry no presentation time.
+ * The sender's frame period and the arrival jitter (mean deviation of the gaps, RFC 3550 style)
+ * are tracked, each frame is due one period after the previous one, pulled slowly towards
+ * arrival + PLAYOUT_JITTER_FACTOR * jitter, and never before its arrival or later than the budget.
+ * It makes no SDK calls, times are us of sdk_system_get_time, so it runs in the host build too.
+ */
+
+#ifndef PLAYOUT_H_
+#define PLAYOUT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef PLAYOUT_JITTER_FACTOR
+#define PLAYOUT_JITTER_FACTOR 3
+#endif
+
+#ifndef PLAYOUT_RESET
+#define PLAYOUT_RESET 1000 /* ms, a longer pause starts a new stream */
+#endif
+
+#ifndef PLAYOUT_MAX_DELAY
+#define PLAYOUT_MAX_DELAY 500 /* ms, limit of the budget and of the presentation times sent by senders */
+#endif
+
+struct playout {
+    bool started;
+    uint32_t period;        // us, smoothed gap between frames
+    uint32_t jitter;        // us, smoothed deviation of the gaps
+    uint32_t last_arrival;
+    uint32_t last_due;
+};
+
+/**
+ * Returns the presentation time of a frame that arrived at arrival_us, delayed up to budget_us.
+ */
+uint32_t playout_due(struct playout *p, uint32_t arrival_us, uint32_t budget_us);
+
+#endif /* PLAYOUT_H_ */
@@ -0,0 +1,83 @@
+/*
+ * probe.c
+ *
+ * Latency probes, see probe.h
+ */
+#include "espressif/esp_common.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "probe.h"
+#include "art_net.h"
+#include "ws2812.h"
+#include "logger.h"
+
+static const char* TAG = "probe";
+
+struct probe {
+    uint8_t head[12]; // ID + T1, echoed
+    uint32_t ip;
+    uint16_t port;
+    uint32_t arrival;
+    uint32_t parsed;
+};
+
+static struct probe waiting;
+static volatile bool pending = false;
+
+static uint8_t *put_be32(uint8_t *p, uint32_t v) {
+    for(int i=3;i>=0;--i) *(p++) = v >> (8 * i);
+    return p;
+}
+
+int probe_command(uint8_t *buf, size_t len, uint32_t arrival_us) {
+    struct probe probe = {.arrival = arrival_us};
+
+    if(len < sizeof(probe.head)) return -1;
+    memcpy(probe.head, buf, sizeof(probe.head));
+    art_net_sender(&probe.ip, &probe.port);
+    // the frame is applied before the probe is armed, so the next output carries it
+    if(len > sizeof(probe.head)) ws2812_update(buf + sizeof(probe.head), len - sizeof(probe.head));
+    probe.parsed = sdk_system_get_time();
+    taskENTER_CRITICAL();
+    waiting = probe;
+    pending = true;
+    taskEXIT_CRITICAL();
+    ws2812_refresh();
+    return 0;
+}
+
+bool probe_pending() {
+    return pending;
+}
+
+void probe_frame(uint32_t rendered_us, uint32_t output_us) {
+    uint8_t reply[32], *p = reply;
+    struct probe probe;
+
+    taskENTER_CRITICAL();
+    probe = waiting;
+    // a probe armed while the frame was being sent waits for the next one
+    if(!pending || (int32_t)(rendered_us - probe.parsed) < 0) {
+        taskEXIT_CRITICAL();
+        return;
+    }
+    pending = false;
+    taskEXIT_CRITICAL();
+
+    memcpy(p, probe.head, sizeof(probe.head));
+    p += sizeof(probe.head);
+    p = put_be32(p, probe.arrival);
+    p = put_be32(p, probe.parsed);
+    p = put_be32(p, rendered_us);
+    p = put_be32(p, output_us);
+    p = put_be32(p, WS2812_FRAME_US);
+    LOGV("Probe parsed %d us, rendered %d us, output %d us after arrival", probe.parsed - probe.arrival,
+            rendered_us - probe.arrival, output_us - probe.arrival);
+    if(art_net_send_to(probe.ip, probe.port, ART_NET_PROBE, reply, p - reply) != 0) {
+        LOGW("Probe answer failed");
+    }
+}
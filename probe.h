@@ -0,0 +1,35 @@
+/*
+ * probe.h
+ *
+ * Latency probes: a probe packet is timed through the node, from its arrival over the parsing
+ * to the next frame composited and handed to the strip, and answered with these times of the node clock.
+ * See README, 0xf82d, and testing/host/artnet_probe.c that turns them into latency distributions.
+ */
+
+#ifndef PROBE_H_
+#define PROBE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Handles the payload of the probe opcode: ID + T1 [+ WORKMODE + WMPAYLOAD], the frame is applied as live DMX.
+ * arrival_us is when the packet was received, us of sdk_system_get_time.
+ * A newer probe replaces one still waiting for its frame.
+ * Returns 0 on success or negative error code.
+ */
+int probe_command(uint8_t *buf, size_t len, uint32_t arrival_us);
+
+/**
+ * Returns true if a probe waits for the next frame, the updater sends a frame then even if nothing changed.
+ */
+bool probe_pending();
+
+/**
+ * Called by the updater after a frame was handed to the strip, answers the waiting probe
+ * if it was parsed before the frame was rendered.
+ */
+void probe_frame(uint32_t rendered_us, uint32_t output_us);
+
+#endif /* PROBE_H_ */
@@ -0,0 +1,263 @@
+/*
+ * sacn.c
+ *
+ * sACN receiver, see sacn.h
+ */
+#include "espressif/esp_common.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+#include "lwip/sys.h"
+
+#include "sacn.h"
+#include "art_net.h"
+#include "ws2812.h"
+#include "playout.h"
+#include "monitor.h"
+#include "logger.h"
+
+static const char* TAG = "sacn";
+
+/*
+ * E1.31 data packet, offsets of the fields checked in place:
+ * root layer: PREAMBLE(2) POSTAMBLE(2) ACN_ID(12) FLAGS_LENGTH(2) VECTOR(4) CID(16)
+ * framing layer: FLAGS_LENGTH(2) VECTOR(4) SOURCE_NAME(64) PRIORITY SYNC_ADDRESS(2) SEQUENCE OPTIONS UNIVERSE(2)
+ * DMP layer: FLAGS_LENGTH(2) VECTOR ADDRESS_TYPE FIRST_ADDRESS(2) INCREMENT(2) COUNT(2) START_CODE DATA
+ */
+#define SACN_ROOT_VECTOR 18
+#define SACN_CID 22
+#define SACN_FRAMING_VECTOR 40
+#define SACN_PRIORITY 108
+#define SACN_SEQUENCE 111
+#define SACN_OPTIONS 112
+#define SACN_UNIVERSE 113
+#define SACN_DMP_VECTOR 117
+#define SACN_ADDRESS_TYPE 118
+#define SACN_COUNT 123
+#define SACN_START_CODE 125
+#define SACN_DATA 126
+#define SACN_MAX_PACKET (SACN_DATA + 512)
+
+#define VECTOR_ROOT_E131_DATA 0x00000004
+#define VECTOR_E131_DATA_PACKET 0x00000002
+#define VECTOR_DMP_SET_PROPERTY 0x02
+#define OPTION_PREVIEW 0x80
+#define OPTION_TERMINATED 0x40
+#define MAX_PRIORITY 200
+#define MAX_UNIVERSE 63999
+
+// preamble size, postamble size and ACN packet identifier
+static const uint8_t SACN_ROOT[16] = {0x00, 0x10, 0x00, 0x00, 'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0};
+
+struct sacn_source {
+    uint8_t used;
+    uint8_t priority;
+    uint8_t sequence;
+    uint16_t universe;
+    uint8_t cid[16];
+    TickType_t seen;
+};
+
+static struct sacn_source sources[SACN_SOURCES];
+static uint16_t groups[WS2812_SEGMENTS]; // universes of the joined groups
+static int groups_count = 0;
+static struct playout playout;
+
+static inline uint16_t get_be16(const uint8_t *p) {
+    return p[0] << 8 | p[1];
+}
+
+static inline uint32_t get_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/**
+ * Validates the headers of a DMX data packet in the receive buffer, len is the whole packet length.
+ * Returns the number of DMX slots following the start code, or negative error code.
+ */
+static int parse_sacn_header(const uint8_t *buf, int len) {
+    int count;
+    if(len < SACN_DATA) return -1; // insufficient length
+    if(memcmp(buf, SACN_ROOT, sizeof(SACN_ROOT)) || get_be32(buf + SACN_ROOT_VECTOR) != VECTOR_ROOT_E131_DATA) {
+        return -2; // not E1.31 data, e.g. universe discovery or sync
+    }
+    if(get_be32(buf + SACN_FRAMING_VECTOR) != VECTOR_E131_DATA_PACKET || buf[SACN_DMP_VECTOR] != VECTOR_DMP_SET_PROPERTY
+            || buf[SACN_ADDRESS_TYPE] != 0xa1 || buf[SACN_PRIORITY] > MAX_PRIORITY) {
+        return -3; // broken layers
+    }
+    count = get_be16(buf + SACN_COUNT);
+    if(count < 1 || count > 513 || SACN_START_CODE + count > len) return -4; // insufficient payload length
+    return count - 1;
+}
+
+/**
+ * Returns true if the packet is newer than the previous one from its source and no source of
+ * a higher priority sends to the universe.
+ */
+static bool accept_source(const uint8_t *cid, uint16_t universe, uint8_t priority, uint8_t sequence, bool terminated) {
+    struct sacn_source *s, *source = NULL, *slot = NULL;
+    TickType_t now = xTaskGetTickCount();
+    uint8_t top = 0;
+    int8_t ahead;
+
+    for(s=sources;s<sources+SACN_SOURCES;++s) {
+        if(s->used && now - s->seen >= SACN_SOURCE_TIMEOUT / portTICK_PERIOD_MS) {
+            LOGI("Source of universe %d lost", s->universe);
+            s->used = 0;
+        }
+        if(s->used && s->universe == universe && !memcmp(s->cid, cid, sizeof(s->cid))) {
+            source = s;
+            continue;
+        }
+        if(s->used && s->universe == universe && s->priority > top) top = s->priority;
+        if(!slot || (slot->used && (!s->used || (int32_t)(s->seen - slot->seen) < 0))) slot = s;
+    }
+    if(!source) {
+        if(terminated) return false;
+        if(slot->used) LOGW("Too many sources, forgetting one of universe %d", slot->universe);
+        source = slot;
+        *source = (struct sacn_source){.used = 1, .universe = universe, .sequence = sequence - 1};
+        memcpy(source->cid, cid, sizeof(source->cid));
+        LOGI("New source of universe %d, priority %d", universe, priority);
+    }
+    // E1.31 6.7.2: up to 20 behind the last sequence is late or repeated
+    ahead = sequence - source->sequence;
+    if(ahead <= 0 && ahead > -20) {
+        LOGD("Late sequence %d, last %d", sequence, source->sequence);
+        return false;
+    }
+    if(terminated) {
+        LOGI("Source of universe %d terminated", universe);
+        source->used = 0;
+        return false;
+    }
+    source->sequence = sequence;
+    source->priority = priority;
+    source->seen = now;
+    if(priority < top) {
+        LOGD("Priority %d below %d of universe %d", priority, top, universe);
+        return false;
+    }
+    return true;
+}
+
+static void parse_sacn(uint8_t *buf, int len, uint32_t arrival_us) {
+    int count = parse_sacn_header(buf, len);
+    if(count < 0) {
+        LOGD("Not an E1.31 DMX packet (%d)", count);
+        return;
+    }
+    uint16_t universe = get_be16(buf + SACN_UNIVERSE);
+    uint8_t options = buf[SACN_OPTIONS];
+    LOGD("Got sACN univ: %d, prio: %d, seq: %d, len: %d", universe, buf[SACN_PRIORITY], buf[SACN_SEQUENCE], count);
+    // alternate start codes, e.g. per address priority, and preview data are not shown
+    if(buf[SACN_START_CODE] != 0 || (options & OPTION_PREVIEW) || !art_net_universe(universe)) return;
+    if(!accept_source(buf + SACN_CID, universe, buf[SACN_PRIORITY], buf[SACN_SEQUENCE], options & OPTION_TERMINATED)) {
+        return;
+    }
+    art_net_show_dmx(&playout, universe, buf + SACN_DATA, count, arrival_us);
+}
+
+static void set_group(int sock, uint16_t universe, int option) {
+    struct ip_mreq mreq;
+    mreq.imr_multiaddr.s_addr = htonl(0xefff0000 | universe); // 239.255.UNIVERSE_HI.UNIVERSE_LO
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if(setsockopt(sock, IPPROTO_IP, option, &mreq, sizeof(mreq)) < 0) {
+        LOGW("Unable to %s the group of universe %d: errno %d", option == IP_ADD_MEMBERSHIP ? "join" : "leave",
+                universe, errno);
+    }
+}
+
+static bool has_universe(const uint16_t *universes, int count, uint16_t universe) {
+    for(int i=0;i<count;++i) {
+        if(universes[i] == universe) return true;
+    }
+    return false;
+}
+
+/**
+ * Joins the groups of the universes shown now and leaves the others.
+ */
+static void update_groups(int sock) {
+    uint16_t wanted[WS2812_SEGMENTS];
+    int count = 0, all = art_net_universes(wanted, WS2812_SEGMENTS);
+
+    for(int i=0;i<all;++i) {
+        if(wanted[i] >= 1 && wanted[i] <= MAX_UNIVERSE) wanted[count++] = wanted[i];
+    }
+    for(int i=0;i<groups_count;++i) {
+        if(!has_universe(wanted, count, groups[i])) set_group(sock, groups[i], IP_DROP_MEMBERSHIP);
+    }
+    for(int i=0;i<count;++i) {
+        if(!has_universe(groups, groups_count, wanted[i])) {
+            LOGI("Joining the group of universe %d", wanted[i]);
+            set_group(sock, wanted[i], IP_ADD_MEMBERSHIP);
+        }
+    }
+    memcpy(groups, wanted, sizeof(uint16_t) * count);
+    groups_count = count;
+}
+
+static void sacn_server_task(void *pvParameters)
+{
+    uint8_t *rx_buffer = malloc(SACN_MAX_PACKET);
+    TickType_t checked;
+    LOGI("Started task");
+
+    while (1) {
+        struct sockaddr_in destAddr;
+        destAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+        destAddr.sin_family = AF_INET;
+        destAddr.sin_port = htons(SACN_PORT);
+
+        int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+        if (sock < 0) {
+            LOGE("Unable to create socket: errno %d", errno);
+            break;
+        }
+        if (bind(sock, (struct sockaddr *)&destAddr, sizeof(destAddr)) < 0) {
+            LOGE("Socket unable to bind: errno %d", errno);
+            close(sock);
+            break;
+        }
+        // wakes up to follow changes of the universes when nothing comes
+        struct timeval timeout = {.tv_sec = SACN_GROUPS_CHECK / 1000, .tv_usec = SACN_GROUPS_CHECK % 1000 * 1000};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        groups_count = 0;
+        checked = xTaskGetTickCount() - SACN_GROUPS_CHECK / portTICK_PERIOD_MS;
+        LOGI("Listening on port %d", SACN_PORT);
+
+        while (1) {
+            if(xTaskGetTickCount() - checked >= SACN_GROUPS_CHECK / portTICK_PERIOD_MS) {
+                update_groups(sock);
+                checked = xTaskGetTickCount();
+            }
+            int len = recv(sock, rx_buffer, SACN_MAX_PACKET, 0);
+            uint32_t arrival = sdk_system_get_time();
+            if (len < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) continue;
+                LOGE("recv failed: errno %d", errno);
+                break;
+            }
+            parse_sacn(rx_buffer, len, arrival);
+        }
+
+        LOGI("Shutting down socket and restarting...");
+        shutdown(sock, 0);
+        close(sock);
+    }
+    vTaskDelete(NULL);
+}
+
+void init_sacn_server() {
+    TaskHandle_t task = NULL;
+    xTaskCreate(sacn_server_task, "sacn_server", 512, NULL, 5, &task);
+    monitor_register(task);
+}
@@ -0,0 +1,32 @@
+/*
+ * sacn.h
+ *
+ * sACN (ANSI E1.31) receiver. Universes shown by the node, the DMX universe or the universes of
+ * the segments, are joined as multicast groups 239.255.UNIVERSE_HI.UNIVERSE_LO, unicast is taken too.
+ * DMX goes through the same slicing by the DMX Address and segments as ArtDmx.
+ * Of the sources sending to a universe only those of the highest priority are shown,
+ * a source is dropped after SACN_SOURCE_TIMEOUT ms of silence or when it terminates its stream.
+ */
+
+#ifndef SACN_H_
+#define SACN_H_
+
+#ifndef SACN_PORT
+#define SACN_PORT 5568
+#endif
+
+#ifndef SACN_SOURCES
+#define SACN_SOURCES 4 /* tracked sources of all universes */
+#endif
+
+#ifndef SACN_SOURCE_TIMEOUT
+#define SACN_SOURCE_TIMEOUT 2500 /* ms, the network data loss timeout of E1.31 */
+#endif
+
+#ifndef SACN_GROUPS_CHECK
+#define SACN_GROUPS_CHECK 1000 /* ms between checks of the universes to join */
+#endif
+
+void init_sacn_server();
+
+#endif /* SACN_H_ */
@@ -0,0 +1,123 @@
+/*
+ * swar.h
+ *
+ * Word-at-a-time (SWAR) pixel kernels shared by the renderers: the DMX_STRAIGHT copy moves 12 DMX bytes,
+ * 4 pixels, as 3 words and reorders them into ws2812_pixel_t, the tint blend works on two 8-bit channels
+ * held in the 16-bit lanes of a word and divides by 255 with shifts.
+ * The kernels are static inline so that loops called with LED_NUMBER get their trip count and tail
+ * at compile time. The word reorder is picked by the field layout of ws2812_pixel_t, a layout without
+ * a word kernel, e.g. with white, is copied a pixel at a time.
+ */
+
+#ifndef SWAR_H_
+#define SWAR_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "color_conv.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+    #error "The SWAR kernels expect a little endian target"
+#endif
+
+#define SWAR_LANES 0x00ff00ffu
+
+// 3 byte pixels stored as red, green, blue or as blue, green, red
+#define SWAR_PIXEL_RGB (sizeof(ws2812_pixel_t) == 3 && offsetof(ws2812_pixel_t, red) == 0 \
+        && offsetof(ws2812_pixel_t, green) == 1)
+#define SWAR_PIXEL_BGR (sizeof(ws2812_pixel_t) == 3 && offsetof(ws2812_pixel_t, red) == 2 \
+        && offsetof(ws2812_pixel_t, green) == 1)
+
+/**
+ * Unaligned word access, DMX data starts at any offset of the packet and segments at any pixel.
+ */
+static inline uint32_t swar_load(const void *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void swar_store(void *p, uint32_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+/**
+ * x/255 rounded down in both 16-bit lanes, for lanes in 0..255*255.
+ */
+static inline uint32_t swar_div255(uint32_t x) {
+    x += 0x00010001u + ((x >> 8) & SWAR_LANES);
+    return (x >> 8) & SWAR_LANES;
+}
+
+/**
+ * Copies count pixels of DMX RGB bytes to dst.
+ * Returns nonzero if any of the copied channels changed.
+ */
+static inline uint32_t swar_copy_rgb(ws2812_pixel_t *dst, const uint8_t *src, int count) {
+    uint32_t diff = 0;
+    int i = 0;
+
+    if(SWAR_PIXEL_RGB) {
+        for(;i+4<=count;i+=4, src+=12) {
+            uint8_t *d = (uint8_t*)(dst + i);
+            for(int k=0;k<12;k+=4) {
+                uint32_t w = swar_load(src + k);
+                diff |= swar_load(d + k) ^ w;
+                swar_store(d + k, w);
+            }
+        }
+    } else if(SWAR_PIXEL_BGR) {
+        for(;i+4<=count;i+=4, src+=12) {
+            uint8_t *d = (uint8_t*)(dst + i);
+            // in: r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3, out: b0 g0 r0 b1 | g1 r1 b2 g2 | r2 b3 g3 r3
+            uint32_t w0 = swar_load(src), w1 = swar_load(src + 4), w2 = swar_load(src + 8);
+            uint32_t o0 = ((w0 >> 16) & 0xff) | (w0 & 0xff00) | ((w0 & 0xff) << 16) | ((w1 & 0xff00) << 16);
+            uint32_t o1 = (w1 & 0xff) | ((w0 >> 16) & 0xff00) | ((w2 & 0xff) << 16) | (w1 & 0xff000000);
+            uint32_t o2 = ((w1 >> 16) & 0xff) | ((w2 >> 16) & 0xff00) | (w2 & 0xff0000) | ((w2 & 0xff00) << 16);
+            diff |= (swar_load(d) ^ o0) | (swar_load(d + 4) ^ o1) | (swar_load(d + 8) ^ o2);
+            swar_store(d, o0);
+            swar_store(d + 4, o1);
+            swar_store(d + 8, o2);
+        }
+    }
+    for(;i<count;++i, src+=3) {
+        diff |= (dst[i].red ^ src[0]) | (dst[i].green ^ src[1]) | (dst[i].blue ^ src[2]);
+        dst[i].red   = src[0];
+        dst[i].green = src[1];
+        dst[i].blue  = src[2];
+    }
+    return diff;
+}
+
+/**
+ * Blends count pixels toward the tint: pixel = (pixel*(255-level) + tint*level)/255 rounded down.
+ * Red and blue of a pixel share a word, the greens of two pixels another one.
+ */
+static inline void swar_tint(ws2812_pixel_t *px, int count, const ws2812_pixel_t *tint, uint8_t level) {
+    uint32_t keep = 255 - level;
+    uint32_t rb_tint = ((uint32_t)tint->red | (uint32_t)tint->blue << 16) * level;
+    uint32_t gg_tint = ((uint32_t)tint->green | (uint32_t)tint->green << 16) * level;
+    int i = 0;
+
+    for(;i+2<=count;i+=2) {
+        uint32_t rb0 = swar_div255(((uint32_t)px[i].red | (uint32_t)px[i].blue << 16) * keep + rb_tint);
+        uint32_t rb1 = swar_div255(((uint32_t)px[i+1].red | (uint32_t)px[i+1].blue << 16) * keep + rb_tint);
+        uint32_t gg = swar_div255(((uint32_t)px[i].green | (uint32_t)px[i+1].green << 16) * keep + gg_tint);
+        px[i].red     = rb0;
+        px[i].blue    = rb0 >> 16;
+        px[i].green   = gg;
+        px[i+1].red   = rb1;
+        px[i+1].blue  = rb1 >> 16;
+        px[i+1].green = gg >> 16;
+    }
+    if(i < count) {
+        uint32_t rb = swar_div255(((uint32_t)px[i].red | (uint32_t)px[i].blue << 16) * keep + rb_tint);
+        px[i].red   = rb;
+        px[i].blue  = rb >> 16;
+        px[i].green = swar_div255(px[i].green * keep + tint->green * level);
+    }
+}
+
+#endif /* SWAR_H_ */
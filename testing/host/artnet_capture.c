@@ -0,0 +1,109 @@
+/*
+ * artnet_capture.c
+ *
+ * Records Art-Net traffic into a capture file (see capture.h) for artnet_replay.
+ * Usage: artnet_capture [-p port] [-d seconds] [-n packets] FILE
+ * Stops after the limits or on Ctrl-C.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "capture.h"
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int sig) {
+    stop = 1;
+}
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-p port] [-d seconds] [-n packets] FILE\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int port = 6454, opt, one = 1;
+    double duration = 0;
+    long limit = 0, count = 0;
+    uint64_t bytes = 0;
+
+    while((opt = getopt(argc, argv, "p:d:n:")) != -1) {
+        switch(opt) {
+        case 'p': port = atoi(optarg); break;
+        case 'd': duration = atof(optarg); break;
+        case 'n': limit = atol(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if(optind != argc - 1) usage(argv[0]);
+
+    FILE *f = fopen(argv[optind], "wb");
+    if(!f || capture_write_header(f) != 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_ANY)};
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        return 1;
+    }
+    // wake up periodically to check the limits
+    struct timeval tv = {0, 100000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    struct sigaction sa = {.sa_handler = on_signal};
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    struct capture_record rec;
+    uint64_t start = 0;
+    printf("Capturing port %d into %s\n", port, argv[optind]);
+    while(!stop && (!limit || count < limit)) {
+        struct sockaddr_in src;
+        socklen_t srclen = sizeof(src);
+        int len = recvfrom(sock, rec.data, sizeof(rec.data), 0, (struct sockaddr *)&src, &srclen);
+        uint64_t t = now_us();
+        if(len < 0) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("recvfrom");
+                break;
+            }
+        } else {
+            // the clock starts with the first packet
+            if(!count) start = t;
+            rec.time_us = t - start;
+            rec.source_ip = src.sin_addr.s_addr;
+            rec.source_port = ntohs(src.sin_port);
+            rec.len = len;
+            if(capture_write(f, &rec) != 0) {
+                perror("write");
+                break;
+            }
+            ++count;
+            bytes += len;
+        }
+        if(duration > 0 && count && t - start >= duration * 1e6) break;
+    }
+    printf("Captured %ld packets, %llu bytes in %.3f s\n", count, (unsigned long long)bytes,
+            count ? (now_us() - start) * 1e-6 : 0.);
+    close(sock);
+    return fclose(f) == 0 ? 0 : 1;
+}
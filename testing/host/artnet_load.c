@@ -0,0 +1,219 @@
+/*
+ * artnet_load.c
+ *
+ * Art-Net load generator: sends ArtDmx for a range of universes at a fixed frame rate,
+ * optionally followed by ArtSync, with random jitter and loss, and reports the achieved rate.
+ * Usage: artnet_load [options] HOST
+ *   -p PORT      destination port (6454)
+ *   -u UNIVERSE  first universe (0)
+ *   -n COUNT     number of universes (1)
+ *   -f FPS       frames per second (40)
+ *   -l LENGTH    DMX data length, even, 2..512 (512)
+ *   -s SHIFT     first channel of the gradient (0)
+ *   -d SECONDS   duration, 0 runs forever (10)
+ *   -j MS        max random delay of each packet within the frame (0)
+ *   -x PERCENT   random packet loss (0)
+ *   -S           send ArtSync after each frame
+ *   -b           allow broadcast destination
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define ART_NET_DMX 0x5000
+#define ART_NET_SYNC 0x5200
+#define ART_NET_HEADER 18
+#define DMX_MAX 512
+
+static const char ART_NET_TAG[8] = "Art-Net";
+
+struct options {
+    const char *host;
+    int port, universe, count, fps, length, shift, jitter, loss, sync, broadcast;
+    double duration;
+};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t) {
+    struct timespec ts = {t / 1000000000, t % 1000000000};
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+static size_t art_header(uint8_t *buf, uint16_t opcode) {
+    memcpy(buf, ART_NET_TAG, sizeof(ART_NET_TAG));
+    buf[8] = opcode & 0xff;
+    buf[9] = opcode >> 8;
+    buf[10] = 0; // ProtVerHi
+    buf[11] = 14;
+    return 12;
+}
+
+/**
+ * Fills ArtDmx with a DMX_STRAIGHT (workmode 0) gradient moving with the frame number.
+ */
+static size_t art_dmx(uint8_t *buf, const struct options *o, uint8_t sequence, uint16_t universe, uint32_t frame) {
+    uint8_t *data = buf + ART_NET_HEADER;
+    art_header(buf, ART_NET_DMX);
+    buf[12] = sequence;
+    buf[13] = 0; // physical
+    buf[14] = universe & 0xff;
+    buf[15] = (universe >> 8) & 0x7f;
+    buf[16] = o->length >> 8;
+    buf[17] = o->length & 0xff;
+    memset(data, 0, o->length);
+    if(o->shift < o->length) {
+        data[o->shift] = 0; // workmode
+        for(int i=o->shift + 1;i<o->length;++i) {
+            data[i] = (uint8_t)(i + frame * 4);
+        }
+    }
+    return ART_NET_HEADER + o->length;
+}
+
+static size_t art_sync(uint8_t *buf) {
+    size_t len = art_header(buf, ART_NET_SYNC);
+    buf[len++] = 0; // Aux1
+    buf[len++] = 0; // Aux2
+    return len;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-p port] [-u universe] [-n count] [-f fps] [-l length] [-s shift]"
+            " [-d seconds] [-j jitter_ms] [-x loss_percent] [-S] [-b] HOST\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    struct options o = {.port = 6454, .count = 1, .fps = 40, .length = DMX_MAX, .duration = 10};
+    int opt;
+
+    while((opt = getopt(argc, argv, "p:u:n:f:l:s:d:j:x:Sb")) != -1) {
+        switch(opt) {
+        case 'p': o.port = atoi(optarg); break;
+        case 'u': o.universe = atoi(optarg); break;
+        case 'n': o.count = atoi(optarg); break;
+        case 'f': o.fps = atoi(optarg); break;
+        case 'l': o.length = atoi(optarg); break;
+        case 's': o.shift = atoi(optarg); break;
+        case 'd': o.duration = atof(optarg); break;
+        case 'j': o.jitter = atoi(optarg); break;
+        case 'x': o.loss = atoi(optarg); break;
+        case 'S': o.sync = 1; break;
+        case 'b': o.broadcast = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if(optind != argc - 1) usage(argv[0]);
+    o.host = argv[optind];
+    if(o.count < 1 || o.fps < 1 || o.length < 2 || o.length > DMX_MAX || (o.length & 1) ||
+            o.universe < 0 || o.universe + o.count > 0x8000) {
+        fprintf(stderr, "Invalid options\n");
+        return 2;
+    }
+
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM}, *dest;
+    char port[8];
+    snprintf(port, sizeof(port), "%d", o.port);
+    if(getaddrinfo(o.host, port, &hints, &dest) != 0) {
+        fprintf(stderr, "Unable to resolve %s\n", o.host);
+        return 1;
+    }
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if(sock < 0) {
+        perror("socket");
+        return 1;
+    }
+    if(o.broadcast) setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &o.broadcast, sizeof(o.broadcast));
+
+    uint8_t *sequences = malloc(o.count);
+    memset(sequences, 1, o.count); // 0 would disable sequence checking on the receiver
+    int *order = malloc(o.count * sizeof(int));
+    uint8_t buf[ART_NET_HEADER + DMX_MAX];
+    uint64_t period = 1000000000ull / o.fps, jitter = o.jitter * 1000000ull;
+    uint64_t start = now_ns(), next = start, report = start + 1000000000ull;
+    uint64_t end = o.duration > 0 ? start + (uint64_t)(o.duration * 1e9) : UINT64_MAX;
+    uint64_t frames = 0, packets = 0, dropped = 0, bytes = 0, errors = 0, late = 0;
+    uint64_t r_frames = 0, r_packets = 0, r_bytes = 0;
+    srand(start);
+
+    printf("Sending %d universes from %d, %d channels at %d fps to %s:%d\n",
+            o.count, o.universe, o.length, o.fps, o.host, o.port);
+    while(next < end) {
+        // with jitter every packet gets its own random delay within the frame, so they may get reordered
+        for(int i=0;i<o.count;++i) order[i] = i;
+        if(jitter) {
+            for(int i=o.count-1;i>0;--i) {
+                int j = rand() % (i + 1), t = order[i];
+                order[i] = order[j];
+                order[j] = t;
+            }
+        }
+        for(int k=0;k<o.count;++k) {
+            int i = order[k];
+            size_t len = art_dmx(buf, &o, sequences[i], o.universe + i, frames);
+            sequences[i] = sequences[i] == 0xff ? 1 : sequences[i] + 1;
+            if(jitter) sleep_until(next + jitter * k / o.count + rand() % (jitter / o.count + 1));
+            if(rand() % 100 < o.loss) {
+                ++dropped;
+                continue;
+            }
+            if(sendto(sock, buf, len, 0, dest->ai_addr, dest->ai_addrlen) < 0) {
+                ++errors;
+                continue;
+            }
+            ++packets;
+            bytes += len;
+        }
+        if(o.sync) {
+            size_t len = art_sync(buf);
+            if(sendto(sock, buf, len, 0, dest->ai_addr, dest->ai_addrlen) < 0) ++errors;
+            else {
+                ++packets;
+                bytes += len;
+            }
+        }
+        ++frames;
+        next += period;
+        uint64_t t = now_ns();
+        if(t > next) {
+            // do not burst to catch up, the frame is lost
+            ++late;
+            next = t;
+        }
+        if(t >= report) {
+            double s = (t - report + 1000000000ull) * 1e-9;
+            printf("frames/s %.1f, packets/s %.0f, Mbit/s %.2f\n", (frames - r_frames) / s,
+                    (packets - r_packets) / s, (bytes - r_bytes) * 8e-6 / s);
+            fflush(stdout);
+            r_frames = frames;
+            r_packets = packets;
+            r_bytes = bytes;
+            report = t + 1000000000ull;
+        }
+        sleep_until(next);
+    }
+
+    double s = (now_ns() - start) * 1e-9;
+    printf("total: %.1f s, frames %llu (%.1f/s), packets %llu (%.0f/s), %.2f Mbit/s, "
+            "dropped %llu, errors %llu, late frames %llu\n",
+            s, (unsigned long long)frames, frames / s, (unsigned long long)packets, packets / s,
+            bytes * 8e-6 / s, (unsigned long long)dropped, (unsigned long long)errors, (unsigned long long)late);
+    freeaddrinfo(dest);
+    close(sock);
+    free(sequences);
+    free(order);
+    return 0;
+}
@@ -0,0 +1,228 @@
+/*
+ * artnet_probe.c
+ *
+ * Latency probe: sends probes (opcode 0xf82d, see README) to nodes at a fixed rate and reports
+ * per node distributions of the one-way network delay and of the pipeline stages timed by the node:
+ * parse (arrival to parsed), render (parsed to composited), output (composited to handed to the strip)
+ * and total (sent by the host to the strip, plus the wire time of the frame).
+ * The one-way delay is half the round trip without the time spent on the node.
+ * Usage: artnet_probe [options] HOST...
+ *   -p PORT      destination port (6454)
+ *   -r RATE      probes per second to each node (10)
+ *   -n COUNT     probes to each node (100)
+ *   -l LEDS      pixels of the DMX_STRAIGHT frame carried by the probes, 0 probes the current look (0)
+ *   -w MS        wait for late answers after the last probe (500)
+ *   -B US        latency budget, exits with 1 if p99 of the total of any node is over it
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define ART_NET_PROBE 0xf82d
+#define PROBE_HEAD 12 // ID + T1
+#define PROBE_ANSWER 32
+#define MAX_NODES 16
+#define MAX_LEDS 170
+
+static const char ART_NET_TAG[8] = "Art-Net";
+
+enum {
+    STAGE_ONE_WAY,
+    STAGE_PARSE,
+    STAGE_RENDER,
+    STAGE_OUTPUT,
+    STAGE_TOTAL,
+    STAGE_COUNT
+};
+
+static const char *stage_names[STAGE_COUNT] = {"one-way", "parse", "render", "output", "total"};
+
+struct node {
+    const char *host;
+    struct sockaddr_in addr;
+    uint32_t sent, answered, stale;
+    uint32_t *us[STAGE_COUNT];
+};
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t get_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static uint64_t get_be64(const uint8_t *p) {
+    return (uint64_t)get_be32(p) << 32 | get_be32(p + 4);
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    for(int i=0;i<4;++i) p[i] = v >> (8 * (3 - i));
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Fills a probe with a DMX_STRAIGHT frame that changes with every probe, so the node always renders it.
+ */
+static size_t art_probe(uint8_t *buf, uint32_t id, uint64_t t1, int leds) {
+    uint8_t *p = buf + 10;
+    memcpy(buf, ART_NET_TAG, sizeof(ART_NET_TAG));
+    buf[8] = ART_NET_PROBE & 0xff;
+    buf[9] = ART_NET_PROBE >> 8;
+    put_be32(p, id);
+    put_be32(p + 4, t1 >> 32);
+    put_be32(p + 8, t1);
+    p += PROBE_HEAD;
+    if(leds) {
+        *(p++) = 0; // workmode
+        for(int i=0;i<leds * 3;++i) *(p++) = (uint8_t)(i + id * 8);
+    }
+    return p - buf;
+}
+
+static struct node *find_node(struct node *nodes, int count, const struct sockaddr_in *from) {
+    for(int i=0;i<count;++i) {
+        if(nodes[i].addr.sin_addr.s_addr == from->sin_addr.s_addr && nodes[i].addr.sin_port == from->sin_port) {
+            return &nodes[i];
+        }
+    }
+    return NULL;
+}
+
+static void receive(int sock, struct node *nodes, int count, int timeout_ms) {
+    struct pollfd pfd = {.fd = sock, .events = POLLIN};
+    uint8_t buf[128];
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    struct node *n;
+
+    while(poll(&pfd, 1, timeout_ms) > 0) {
+        timeout_ms = 0;
+        fromlen = sizeof(from);
+        ssize_t len = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen);
+        uint64_t t4 = now_us();
+        if(len < 10 + PROBE_ANSWER || memcmp(buf, ART_NET_TAG, sizeof(ART_NET_TAG))
+                || (buf[8] | (buf[9] << 8)) != ART_NET_PROBE || !(n = find_node(nodes, count, &from))) {
+            continue;
+        }
+        const uint8_t *a = buf + 10;
+        uint32_t id = get_be32(a);
+        uint64_t t1 = get_be64(a + 4);
+        uint32_t arrival = get_be32(a + 12), parsed = get_be32(a + 16), rendered = get_be32(a + 20);
+        uint32_t output = get_be32(a + 24), wire = get_be32(a + 28);
+        uint32_t on_node = output - arrival;
+        if(id >= n->sent || t4 - t1 < on_node) {
+            ++n->stale;
+            continue;
+        }
+        uint32_t i = n->answered++;
+        n->us[STAGE_ONE_WAY][i] = (t4 - t1 - on_node) / 2;
+        n->us[STAGE_PARSE][i] = parsed - arrival;
+        n->us[STAGE_RENDER][i] = rendered - parsed;
+        n->us[STAGE_OUTPUT][i] = output - rendered;
+        n->us[STAGE_TOTAL][i] = n->us[STAGE_ONE_WAY][i] + on_node + wire;
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-p port] [-r rate] [-n count] [-l leds] [-w wait_ms] [-B budget_us] HOST...\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int port = 6454, rate = 10, count = 100, leds = 0, wait_ms = 500, budget = 0, opt;
+
+    while((opt = getopt(argc, argv, "p:r:n:l:w:B:")) != -1) {
+        switch(opt) {
+        case 'p': port = atoi(optarg); break;
+        case 'r': rate = atoi(optarg); break;
+        case 'n': count = atoi(optarg); break;
+        case 'l': leds = atoi(optarg); break;
+        case 'w': wait_ms = atoi(optarg); break;
+        case 'B': budget = atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    int node_count = argc - optind;
+    if(node_count < 1) usage(argv[0]);
+    if(node_count > MAX_NODES || rate < 1 || count < 1 || leds < 0 || leds > MAX_LEDS) {
+        fprintf(stderr, "Invalid options\n");
+        return 2;
+    }
+
+    struct node *nodes = calloc(node_count, sizeof(struct node));
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM}, *dest;
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    for(int i=0;i<node_count;++i) {
+        nodes[i].host = argv[optind + i];
+        if(getaddrinfo(nodes[i].host, port_str, &hints, &dest) != 0) {
+            fprintf(stderr, "Unable to resolve %s\n", nodes[i].host);
+            return 1;
+        }
+        memcpy(&nodes[i].addr, dest->ai_addr, sizeof(nodes[i].addr));
+        freeaddrinfo(dest);
+        for(int s=0;s<STAGE_COUNT;++s) nodes[i].us[s] = malloc(count * sizeof(uint32_t));
+    }
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if(sock < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    // nodes are probed one after another within the period, each probe is answered after the next frame
+    uint8_t buf[10 + PROBE_HEAD + 1 + MAX_LEDS * 3];
+    uint64_t period = 1000000 / rate, step = period / node_count, next = now_us();
+    printf("Probing %d nodes, %d probes each at %d/s%s\n", node_count, count, rate, leds ? ", with frames" : "");
+    for(int k=0;k<count;++k) {
+        for(int i=0;i<node_count;++i) {
+            struct node *n = &nodes[i];
+            size_t len = art_probe(buf, n->sent, now_us(), leds);
+            if(sendto(sock, buf, len, 0, (struct sockaddr *)&n->addr, sizeof(n->addr)) < 0) {
+                perror("sendto");
+            }
+            ++n->sent;
+            next += step;
+            int64_t left;
+            while((left = next - now_us()) > 0) receive(sock, nodes, node_count, (left + 999) / 1000);
+        }
+    }
+    receive(sock, nodes, node_count, wait_ms);
+
+    int over = 0;
+    for(int i=0;i<node_count;++i) {
+        struct node *n = &nodes[i];
+        printf("%s: sent %u, answered %u, stale %u\n", n->host, n->sent, n->answered, n->stale);
+        if(!n->answered) {
+            over |= budget != 0;
+            continue;
+        }
+        for(int s=0;s<STAGE_COUNT;++s) {
+            uint32_t *us = n->us[s];
+            qsort(us, n->answered, sizeof(uint32_t), cmp_u32);
+            printf("  %-8s us: p50 %u, p90 %u, p99 %u, max %u\n", stage_names[s], us[n->answered / 2],
+                    us[n->answered * 9 / 10], us[n->answered * 99 / 100], us[n->answered - 1]);
+        }
+        if(budget && n->us[STAGE_TOTAL][n->answered * 99 / 100] > (uint32_t)budget) {
+            printf("  p99 total is over the budget of %d us\n", budget);
+            over = 1;
+        }
+    }
+    close(sock);
+    return over;
+}
@@ -0,0 +1,222 @@
+/*
+ * artnet_replay.c
+ *
+ * Replays a capture file (see capture.h) keeping the original timing, optionally scaled.
+ * By default the firmware runs in-process (as in artnet2ws2812_host) and gets the packets over loopback,
+ * then rendered frames, dropped frames, packet-to-strip latency and gaps between shown frames are reported.
+ * With -b the firmware buffers the frames for playout within the budget in ms.
+ * With -t the packets are sent to a real node instead and only the send timing is reported.
+ * Usage: artnet_replay [-s speed] [-u universe] [-S shift] [-l loops] [-b budget] [-t HOST [-p port]] FILE
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "FreeRTOS.h"
+
+#include "ws2812.h"
+#include "art_net.h"
+#include "monitor.h"
+#include "config.h"
+#include "capture.h"
+#include "host.h"
+
+#define MAX_SAMPLES (1 << 20)
+#define SENT_RING 256
+
+struct samples {
+    uint32_t *us;
+    size_t count;
+};
+
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t pending_at = 0; // send time of the newest DMX packet not shown yet
+static uint32_t pending = 0, rendered = 0, dropped = 0;
+static struct samples latency, gaps;
+static int budget = 0;
+static uint64_t sent_at[SENT_RING]; // send times of DMX packets, for the playout
+static uint32_t sent_count = 0;
+static uint64_t last_shown = 0;
+
+static void add_sample(struct samples *s, uint64_t us) {
+    if(s->count < MAX_SAMPLES) s->us[s->count++] = us > UINT32_MAX ? UINT32_MAX : us;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_percentiles(const char *name, struct samples *s) {
+    if(!s->count) {
+        printf("%s: no samples\n", name);
+        return;
+    }
+    qsort(s->us, s->count, sizeof(uint32_t), cmp_u32);
+    printf("%s us: p50 %u, p90 %u, p99 %u, max %u\n", name, s->us[s->count / 2], s->us[s->count * 9 / 10],
+            s->us[s->count * 99 / 100], s->us[s->count - 1]);
+}
+
+/**
+ * A strip frame shows the newest packet, older ones were superseded without being shown.
+ * With the playout packets are shown one by one in the order they were sent.
+ */
+static void on_frame(const ws2812_pixel_t *pixels, int count, void *arg) {
+    uint64_t t = host_time_us();
+    pthread_mutex_lock(&stats_mutex);
+    if(pending) {
+        ++rendered;
+        if(budget) {
+            add_sample(&latency, t - sent_at[(sent_count - pending) % SENT_RING]);
+            --pending;
+        } else {
+            dropped += pending - 1;
+            add_sample(&latency, t - pending_at);
+            pending = 0;
+        }
+        if(last_shown) add_sample(&gaps, t - last_shown);
+        last_shown = t;
+    }
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+static int is_dmx_for(const struct capture_record *rec, int universe) {
+    return rec->len >= 18 && !memcmp(rec->data, "Art-Net", 8) && rec->data[8] == 0x00 && rec->data[9] == 0x50
+            && (rec->data[14] | (rec->data[15] << 8)) == universe;
+}
+
+/**
+ * Sleeps until host_time_us() reaches t, the host clock starts at boot and not at the monotonic epoch.
+ */
+static void sleep_until_us(uint64_t t) {
+    uint64_t now;
+    while((now = host_time_us()) < t) {
+        struct timespec ts = {(t - now) / 1000000, ((t - now) % 1000000) * 1000};
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-s speed] [-u universe] [-S shift] [-l loops] [-b budget] [-t HOST [-p port]] FILE\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *target = NULL;
+    double speed = 1;
+    int universe = 0, shift = 0, loops = 1, port = ART_NET_PORT, opt;
+
+    while((opt = getopt(argc, argv, "s:u:S:l:b:t:p:")) != -1) {
+        switch(opt) {
+        case 's': speed = atof(optarg); break;
+        case 'u': universe = atoi(optarg); break;
+        case 'S': shift = atoi(optarg); break;
+        case 'l': loops = atoi(optarg); break;
+        case 'b': budget = atoi(optarg); break;
+        case 't': target = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if(optind != argc - 1 || speed <= 0 || loops < 1) usage(argv[0]);
+
+    FILE *f = fopen(argv[optind], "rb");
+    if(!f) {
+        perror(argv[optind]);
+        return 1;
+    }
+    if(capture_read_header(f) != 0) {
+        fprintf(stderr, "%s is not a capture file\n", argv[optind]);
+        return 1;
+    }
+
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM}, *dest;
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    if(getaddrinfo(target ? target : "127.0.0.1", port_str, &hints, &dest) != 0) {
+        fprintf(stderr, "Unable to resolve %s\n", target);
+        return 1;
+    }
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+    struct samples lag = {malloc(MAX_SAMPLES * sizeof(uint32_t)), 0};
+    latency.us = malloc(MAX_SAMPLES * sizeof(uint32_t));
+    gaps.us = malloc(MAX_SAMPLES * sizeof(uint32_t));
+
+    if(!target) {
+        monitor_init();
+        config_init();
+        config.dmx_universe = universe;
+        config.dmx_shift = shift;
+        config.playout_budget = budget;
+        ws2812_init();
+        init_server();
+        // park the base layer on an empty shader so that only the replayed packets cause frames
+        uint8_t idle[] = {DMX_SHADER, 0, 0, 0};
+        ws2812_update(idle, sizeof(idle));
+        usleep(200000);
+        host_strip_set_callback(on_frame, NULL);
+    }
+
+    struct capture_record rec;
+    uint64_t packets = 0, dmx = 0, errors = 0;
+    uint64_t start = host_time_us(), base = start, last = 0;
+    for(int loop=0;loop<loops;++loop) {
+        int ret;
+        while((ret = capture_read(f, &rec)) > 0) {
+            uint64_t at = base + rec.time_us / speed;
+            last = rec.time_us;
+            sleep_until_us(at);
+            int is_dmx = is_dmx_for(&rec, universe);
+            pthread_mutex_lock(&stats_mutex);
+            uint64_t t = host_time_us();
+            if(sendto(sock, rec.data, rec.len, 0, dest->ai_addr, dest->ai_addrlen) < 0) {
+                ++errors;
+            } else if(is_dmx) {
+                ++pending;
+                pending_at = t;
+                sent_at[sent_count++ % SENT_RING] = t;
+                ++dmx;
+            }
+            pthread_mutex_unlock(&stats_mutex);
+            add_sample(&lag, t - at);
+            ++packets;
+        }
+        if(ret < 0) {
+            fprintf(stderr, "Capture file is broken after %llu packets\n", (unsigned long long)packets);
+            break;
+        }
+        base += last / speed;
+        fseek(f, 0, SEEK_SET);
+        capture_read_header(f);
+    }
+    double s = (host_time_us() - start) * 1e-6;
+
+    printf("replayed %llu packets (%llu DMX for universe %d) in %.3f s, speed %.2f, send errors %llu\n",
+            (unsigned long long)packets, (unsigned long long)dmx, universe, s, speed, (unsigned long long)errors);
+    print_percentiles("send lag", &lag);
+    if(!target) {
+        usleep(200000); // let the last frame out
+        pthread_mutex_lock(&stats_mutex);
+        printf("rendered %u, dropped %u, strip frames %u\n", rendered, dropped + pending, host_strip_frames());
+        print_percentiles("latency", &latency);
+        print_percentiles("frame gap", &gaps);
+        pthread_mutex_unlock(&stats_mutex);
+        struct art_net_stats stats;
+        art_net_get_stats(&stats);
+        printf("Art-Net DMX accepted %u, late %u, resyncs %u, other universes %u, invalid %u\n",
+                stats.frames, stats.late, stats.resyncs, stats.other_universe, stats.invalid);
+    }
+    freeaddrinfo(dest);
+    fclose(f);
+    return 0;
+}
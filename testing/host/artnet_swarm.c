@@ -0,0 +1,377 @@
+/*
+ * artnet_swarm.c
+ *
+ * Runs many instances of the firmware in one process to test how nodes scale on one network.
+ * Every instance is a private copy of artnet2ws2812_host.so loaded with dlopen, so the firmware keeps
+ * its globals, tasks and virtual strip per node. Node i takes universe UNIVERSE + i (or UNIVERSE with -U)
+ * and listens on ART_NET_PORT + i, or with -a on ART_NET_PORT of 127.0.0.(2 + i).
+ * The nodes are fed by a generator, a moving DMX_STRAIGHT gradient sent to every node each frame,
+ * or by a capture file (see capture.h) whose packets go to every node with the original timing.
+ * Reported per node and in total: DMX frames sent to the node, shown and dropped (superseded before
+ * they reached the strip), packet-to-strip latency and CPU time of the node tasks. The sync skew
+ * is the spread of the strip times of the nodes showing the same frame.
+ * Usage: artnet_swarm [options] [FILE]
+ *   -n NODES     instances (8)
+ *   -u UNIVERSE  universe of the first node (1)
+ *   -U           every node takes UNIVERSE
+ *   -a           nodes on IP aliases instead of ports
+ *   -f FPS       generator frames per second (40)
+ *   -d SECONDS   generator run time (10)
+ *   -s SPEED     capture replay speed (1)
+ *   -L LIBRARY   firmware library (./artnet2ws2812_host.so)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ws2812.h"
+#include "config.h"
+#include "art_net.h"
+#include "capture.h"
+#include "host.h"
+
+#define MAX_NODES 256
+#define MAX_SAMPLES (1 << 18)
+#define MAX_ROUNDS (1 << 18)
+
+struct samples {
+    uint32_t *us;
+    size_t count;
+};
+
+/* the firmware of a node, resolved in its copy of the library */
+struct firmware {
+    void (*monitor_init)();
+    int (*config_init)();
+    struct config *config;
+    void (*ws2812_init)();
+    void (*ws2812_update)(uint8_t *rgbbytes, int len);
+    void (*init_server)();
+    void (*art_net_get_stats)(struct art_net_stats *stats);
+    void (*host_strip_set_callback)(host_strip_cb_t cb, void *arg);
+    void (*host_node_address)(uint32_t ip, int port_offset);
+    uint64_t (*host_cpu_us)();
+};
+
+struct node {
+    int index;
+    void *lib;
+    struct firmware fw;
+    uint16_t universe;
+    uint8_t sequence;
+    struct sockaddr_in addr;
+    uint32_t sent, shown, dropped;
+    uint32_t pending;       // frames sent and not shown yet
+    uint32_t pending_round; // the newest of them
+    uint64_t pending_at;
+    struct samples latency;
+};
+
+/* strip times of the nodes that showed a frame */
+struct round {
+    uint64_t first, last;
+    uint16_t nodes;
+};
+
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct node nodes[MAX_NODES];
+static struct round *rounds;
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_us(uint64_t t) {
+    uint64_t now;
+    while((now = now_us()) < t) {
+        struct timespec ts = {(t - now) / 1000000, ((t - now) % 1000000) * 1000};
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void add_sample(struct samples *s, uint64_t us) {
+    if(s->count < MAX_SAMPLES) s->us[s->count++] = us > UINT32_MAX ? UINT32_MAX : us;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_percentiles(const char *prefix, const char *name, struct samples *s) {
+    if(!s->count) {
+        printf("%s%s: no samples\n", prefix, name);
+        return;
+    }
+    qsort(s->us, s->count, sizeof(uint32_t), cmp_u32);
+    printf("%s%s us: p50 %u, p90 %u, p99 %u, max %u\n", prefix, name, s->us[s->count / 2], s->us[s->count * 9 / 10],
+            s->us[s->count * 99 / 100], s->us[s->count - 1]);
+}
+
+/**
+ * A strip frame shows the newest frame sent to the node, older ones were superseded without being shown.
+ */
+static void on_frame(const ws2812_pixel_t *pixels, int count, void *arg) {
+    struct node *n = arg;
+    uint64_t t = now_us();
+    pthread_mutex_lock(&stats_mutex);
+    if(n->pending) {
+        ++n->shown;
+        n->dropped += n->pending - 1;
+        add_sample(&n->latency, t - n->pending_at);
+        if(n->pending_round < MAX_ROUNDS) {
+            struct round *r = &rounds[n->pending_round];
+            if(!r->nodes++) r->first = t;
+            if(t < r->first) r->first = t;
+            if(t > r->last) r->last = t;
+        }
+        n->pending = 0;
+    }
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+static int copy_file(const char *from, const char *to) {
+    char buf[65536];
+    size_t len;
+    int ret = 0;
+    FILE *in = fopen(from, "rb"), *out = in ? fopen(to, "wb") : NULL;
+    if(!in || !out) {
+        perror(in ? to : from);
+        if(in) fclose(in);
+        return -1;
+    }
+    while((len = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if(fwrite(buf, 1, len, out) != len) ret = -1;
+    }
+    fclose(in);
+    if(fclose(out) != 0) ret = -1;
+    return ret;
+}
+
+#define RESOLVE(fw, lib, name) ((*(void **)&(fw)->name = dlsym(lib, #name)) != NULL)
+
+/**
+ * Loads a private copy of the firmware library, dlopen of the same file would share one instance.
+ */
+static int load_node(struct node *n, const char *library, const char *dir) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/node%d.so", dir, n->index);
+    if(copy_file(library, path) != 0) return -1;
+    n->lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    unlink(path);
+    if(!n->lib) {
+        fprintf(stderr, "%s\n", dlerror());
+        return -2;
+    }
+    struct firmware *fw = &n->fw;
+    if(!RESOLVE(fw, n->lib, monitor_init) || !RESOLVE(fw, n->lib, config_init) || !RESOLVE(fw, n->lib, config)
+            || !RESOLVE(fw, n->lib, ws2812_init) || !RESOLVE(fw, n->lib, ws2812_update)
+            || !RESOLVE(fw, n->lib, init_server) || !RESOLVE(fw, n->lib, art_net_get_stats)
+            || !RESOLVE(fw, n->lib, host_strip_set_callback) || !RESOLVE(fw, n->lib, host_node_address)
+            || !RESOLVE(fw, n->lib, host_cpu_us)) {
+        fprintf(stderr, "%s: %s\n", library, dlerror());
+        return -3;
+    }
+    return 0;
+}
+
+static void start_node(struct node *n, bool alias) {
+    struct firmware *fw = &n->fw;
+    n->addr.sin_family = AF_INET;
+    n->addr.sin_addr.s_addr = htonl(alias ? INADDR_LOOPBACK + 1 + n->index : INADDR_LOOPBACK);
+    n->addr.sin_port = htons(ART_NET_PORT + (alias ? 0 : n->index));
+    fw->host_node_address(alias ? n->addr.sin_addr.s_addr : 0, alias ? 0 : n->index);
+    fw->monitor_init();
+    fw->config_init();
+    fw->config->dmx_universe = n->universe;
+    fw->config->dmx_shift = 0;
+    fw->ws2812_init();
+    fw->init_server();
+    // park the base layer on an empty shader so that only the frames sent cause strip frames
+    uint8_t idle[] = {DMX_SHADER, 0, 0, 0};
+    fw->ws2812_update(idle, sizeof(idle));
+    n->latency.us = malloc(MAX_SAMPLES * sizeof(uint32_t));
+}
+
+static size_t art_dmx(uint8_t *buf, uint16_t universe, uint8_t sequence, uint32_t frame) {
+    uint16_t length = 1 + LED_NUMBER * 3;
+    if(length > 512) length = 512;
+    memcpy(buf, "Art-Net", 8);
+    buf[8] = 0x00;
+    buf[9] = 0x50; // ArtDmx
+    buf[10] = 0;
+    buf[11] = 14;
+    buf[12] = sequence;
+    buf[13] = 0;
+    buf[14] = universe & 0xff;
+    buf[15] = universe >> 8;
+    buf[16] = length >> 8;
+    buf[17] = length & 0xff;
+    buf[18] = DMX_STRAIGHT;
+    for(int i=1;i<length;++i) buf[18 + i] = (uint8_t)(i * 4 + frame * 8);
+    return 18 + length;
+}
+
+static int dmx_universe(const uint8_t *data, int len) {
+    if(len < 18 || memcmp(data, "Art-Net", 8) || data[8] != 0x00 || data[9] != 0x50) return -1;
+    return data[14] | (data[15] << 8);
+}
+
+/**
+ * Sends a datagram to the node, a DMX frame of its universe is waited for on the strip.
+ */
+static void send_to_node(int sock, struct node *n, const uint8_t *data, size_t len, uint32_t round, int universe,
+        uint32_t *errors) {
+    pthread_mutex_lock(&stats_mutex);
+    uint64_t t = now_us();
+    if(sendto(sock, data, len, 0, (struct sockaddr *)&n->addr, sizeof(n->addr)) < 0) {
+        ++*errors;
+    } else if(universe == n->universe) {
+        ++n->sent;
+        ++n->pending;
+        n->pending_round = round;
+        n->pending_at = t;
+    }
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+static uint64_t rusage_us() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-n nodes] [-u universe] [-U] [-a] [-f fps] [-d seconds] [-s speed] [-L library] [FILE]\n",
+            name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *library = "./artnet2ws2812_host.so";
+    int count = 8, universe = 1, fps = 40, opt;
+    bool same_universe = false, alias = false;
+    double seconds = 10, speed = 1;
+
+    while((opt = getopt(argc, argv, "n:u:Uaf:d:s:L:")) != -1) {
+        switch(opt) {
+        case 'n': count = atoi(optarg); break;
+        case 'u': universe = atoi(optarg); break;
+        case 'U': same_universe = true; break;
+        case 'a': alias = true; break;
+        case 'f': fps = atoi(optarg); break;
+        case 'd': seconds = atof(optarg); break;
+        case 's': speed = atof(optarg); break;
+        case 'L': library = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if(optind < argc - 1 || count < 1 || count > MAX_NODES || fps < 1 || seconds <= 0 || speed <= 0) usage(argv[0]);
+
+    FILE *f = NULL;
+    if(optind < argc) {
+        if(!(f = fopen(argv[optind], "rb"))) {
+            perror(argv[optind]);
+            return 1;
+        }
+        if(capture_read_header(f) != 0) {
+            fprintf(stderr, "%s is not a capture file\n", argv[optind]);
+            return 1;
+        }
+    }
+
+    char dir[] = "/tmp/artnet_swarm.XXXXXX";
+    if(!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    rounds = calloc(MAX_ROUNDS, sizeof(struct round));
+    for(int i=0;i<count;++i) {
+        struct node *n = &nodes[i];
+        n->index = i;
+        n->universe = same_universe ? universe : universe + i;
+        if(load_node(n, library, dir) != 0) {
+            rmdir(dir);
+            return 1;
+        }
+    }
+    rmdir(dir);
+    for(int i=0;i<count;++i) start_node(&nodes[i], alias);
+    usleep(300000); // let the servers bind and the strips settle
+    for(int i=0;i<count;++i) nodes[i].fw.host_strip_set_callback(on_frame, &nodes[i]);
+    printf("%d nodes, %d leds, universe %d%s, %s %d\n", count, LED_NUMBER, universe, same_universe ? "" : " on",
+            alias ? "IP aliases from 127.0.0.2 port" : "ports from", ART_NET_PORT);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    uint32_t round = 0, errors = 0;
+    uint64_t start = now_us(), cpu_start = rusage_us();
+    if(f) {
+        struct capture_record rec;
+        int ret;
+        while((ret = capture_read(f, &rec)) > 0) {
+            sleep_until_us(start + rec.time_us / speed);
+            int u = dmx_universe(rec.data, rec.len);
+            for(int i=0;i<count;++i) send_to_node(sock, &nodes[i], rec.data, rec.len, round, u, &errors);
+            if(u >= 0) ++round;
+        }
+        if(ret < 0) fprintf(stderr, "Capture file is broken after %u DMX packets\n", round);
+        fclose(f);
+    } else {
+        uint8_t buf[18 + 512];
+        uint64_t period = 1000000 / fps, frames = seconds * fps;
+        for(; round<frames; ++round) {
+            sleep_until_us(start + round * period);
+            for(int i=0;i<count;++i) {
+                struct node *n = &nodes[i];
+                n->sequence = n->sequence % 255 + 1;
+                size_t len = art_dmx(buf, n->universe, n->sequence, round);
+                send_to_node(sock, n, buf, len, round, n->universe, &errors);
+            }
+        }
+    }
+    usleep(300000); // let the last frames out
+    double wall = (now_us() - start) * 1e-6;
+    double cpu = (rusage_us() - cpu_start) * 1e-6;
+
+    pthread_mutex_lock(&stats_mutex);
+    uint32_t sent = 0, shown = 0, dropped = 0;
+    struct samples latency = {malloc(MAX_SAMPLES * sizeof(uint32_t)), 0};
+    struct samples skew = {malloc(MAX_SAMPLES * sizeof(uint32_t)), 0};
+    printf("%u frames in %.2f s, send errors %u\n", round, wall, errors);
+    for(int i=0;i<count;++i) {
+        struct node *n = &nodes[i];
+        struct art_net_stats stats;
+        n->fw.art_net_get_stats(&stats);
+        printf("node %d, universe %d, %s:%d: sent %u, shown %u (%.1f %%), dropped %u, cpu %.1f %%, Art-Net late %u\n",
+                i, n->universe, inet_ntoa(n->addr.sin_addr), ntohs(n->addr.sin_port), n->sent, n->shown,
+                n->sent ? n->shown * 100.0 / n->sent : 0, n->dropped + n->pending,
+                n->fw.host_cpu_us() * 1e-4 / wall, stats.late);
+        print_percentiles("  ", "latency", &n->latency);
+        sent += n->sent;
+        shown += n->shown;
+        dropped += n->dropped + n->pending;
+        for(size_t k=0;k<n->latency.count;++k) add_sample(&latency, n->latency.us[k]);
+    }
+    for(uint32_t r=0;r<round && r<MAX_ROUNDS;++r) {
+        if(rounds[r].nodes > 1) add_sample(&skew, rounds[r].last - rounds[r].first);
+    }
+    pthread_mutex_unlock(&stats_mutex);
+    printf("total: sent %u, shown %u (%.1f %%), dropped %u, cpu %.1f %% of a core\n", sent, shown,
+            sent ? shown * 100.0 / sent : 0, dropped, cpu * 100 / wall);
+    print_percentiles("", "latency", &latency);
+    print_percentiles("", "sync skew", &skew);
+    return 0;
+}
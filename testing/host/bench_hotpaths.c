@@ -0,0 +1,391 @@
+/*
+ * bench_hotpaths.c
+ *
+ * Host microbenchmarks of the packet parsing and rendering hot paths of the firmware.
+ * LED_NUMBER is fixed at build time, the Makefile builds one binary per strip length.
+ * Binaries built for another WS2812_PROFILE than GRB run only the benchmarks that depend on the pixel format,
+ * their names carry the profile.
+ * Prints CSV: benchmark,leds,ns_per_op
+ * With -c the results are compared against a CSV produced earlier, rows slower by more than
+ * the threshold are marked REGRESSION and the exit code is 1.
+ * Usage: bench_hotpaths [-n] [-d seconds] [-c BASELINE [-t percent]]
+ *   -n  do not print the CSV header
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "FreeRTOS.h"
+
+#include "ws2812.h"
+#include "art_net.h"
+#include "monitor.h"
+#include "config.h"
+#include "color_conv.h"
+#include "compositor.h"
+#include "pixel_format.h"
+#include "merge.h"
+#include "swar.h"
+#include "wifi_settings.h"
+#include "host.h"
+
+#define BATCHES 5
+#define UNIVERSE 1
+
+#if WS2812_PROFILE == WS2812_PROFILE_GRB
+    #define PROFILE_SUFFIX "_grb"
+#elif WS2812_PROFILE == WS2812_PROFILE_RGB
+    #define PROFILE_SUFFIX "_rgb"
+#elif WS2812_PROFILE == WS2812_PROFILE_BRG
+    #define PROFILE_SUFFIX "_brg"
+#elif WS2812_PROFILE == WS2812_PROFILE_GRBW
+    #define PROFILE_SUFFIX "_grbw"
+#elif WS2812_PROFILE == WS2812_PROFILE_RGBW
+    #define PROFILE_SUFFIX "_rgbw"
+#endif
+
+struct bench {
+    const char *name;
+    void (*run)(long iterations);
+    bool per_profile;
+};
+
+static uint8_t dmx_packet[18 + 512];
+static uint8_t dmx_wrong_universe[18 + 512];
+static uint8_t not_art_net[18 + 512];
+static uint8_t straight[1 + LED_NUMBER * 3];
+static ws2812_pixel_t out[LED_NUMBER];
+static volatile uint32_t sink;
+
+static void fill_dmx(uint8_t *buf, int universe) {
+    memcpy(buf, "Art-Net", 8);
+    buf[8] = 0x00;
+    buf[9] = 0x50; // ArtDmx
+    buf[10] = 0;
+    buf[11] = 14;
+    buf[12] = 0; // sequence 0 disables reordering check
+    buf[14] = universe & 0xff;
+    buf[15] = universe >> 8;
+    buf[16] = 512 >> 8;
+    buf[17] = 512 & 0xff;
+    buf[18] = DMX_STRAIGHT;
+    for(int i=19;i<18+512;++i) buf[i] = i * 7;
+}
+
+static void run_parse_valid(long n) {
+    for(long i=0;i<n;++i) parse_art_net(sizeof(dmx_packet), dmx_packet);
+}
+
+static void run_parse_wrong_universe(long n) {
+    for(long i=0;i<n;++i) parse_art_net(sizeof(dmx_wrong_universe), dmx_wrong_universe);
+}
+
+static void run_parse_invalid(long n) {
+    for(long i=0;i<n;++i) parse_art_net(sizeof(not_art_net), not_art_net);
+}
+
+static void run_update_straight(long n) {
+    for(long i=0;i<n;++i) ws2812_update(straight, sizeof(straight));
+}
+
+static void run_update_chain(long n) {
+    uint8_t chain[] = {DMX_CHAIN, 1, 2, 3};
+    for(long i=0;i<n;++i) ws2812_update(chain, sizeof(chain));
+}
+
+static void run_update_chain_reversed(long n) {
+    uint8_t chain[] = {DMX_CHAIN_REVERSED, 1, 2, 3};
+    for(long i=0;i<n;++i) ws2812_update(chain, sizeof(chain));
+}
+
+// WORKMODE ID DELAY(2) STEP_TIME(2) STEP_LENGTH(2) BEGIN(3) TINT(3) TINT_LEVEL TINT_TYPE
+// delay is long so that the updater stays asleep
+static uint8_t rainbow_rgb[] = {DMX_RAINBOW, 1, 0xff, 0xff, 0, 2, 0, 5, 255, 0, 0, 0, 0, 255, 80, 0};
+static uint8_t rainbow_hsv[] = {DMX_RAINBOW, 1, 0xff, 0xff, 0, 2, 0, 5, 255, 0, 0, 0, 0, 255, 80, 128};
+
+static void run_update_rainbow(long n) {
+    for(long i=0;i<n;++i) ws2812_update(rainbow_rgb, sizeof(rainbow_rgb));
+}
+
+static void run_update_shader(long n) {
+    uint8_t shader[] = {DMX_SHADER, 1, 0xff, 0xff, 10, 20, 30};
+    for(long i=0;i<n;++i) ws2812_update(shader, sizeof(shader));
+}
+
+static void run_rainbow_rgb_tint(long n) {
+    for(long i=0;i<n;++i) ws2812_rainbow_render(out, LED_NUMBER, i);
+    sink += out[0].red;
+}
+
+static void run_rainbow_hsv_tint(long n) {
+    for(long i=0;i<n;++i) ws2812_rainbow_render(out, LED_NUMBER, i);
+    sink += out[0].red;
+}
+
+static void run_rgb2hsv(long n) {
+    color_HSV hsv;
+    for(long i=0;i<n;++i) {
+        ws2812_pixel_t p = {.red = i, .green = i >> 3, .blue = i >> 6};
+        rgb2hsv(&p, &hsv);
+        sink += hsv.h;
+    }
+}
+
+static void run_hsv2rgb(long n) {
+    ws2812_pixel_t p;
+    for(long i=0;i<n;++i) {
+        color_HSV hsv = {.h = i % 360, .s = 1, .v = 1};
+        hsv2rgb(&hsv, &p);
+        sink += p.green;
+    }
+}
+
+static ws2812_pixel_t base_pixels[LED_NUMBER], overlay_pixels[LED_NUMBER];
+static ws2812_pixel_t master = {.red = 255, .green = 200, .blue = 100};
+
+// the layer stack of the firmware: a rendered base, a live overlay over half the strip and a master color
+static void run_compositor(long n) {
+    struct layer layers[] = {
+        {.opacity = 255, .blend = BLEND_REPLACE, .count = LED_NUMBER, .fade_weight = LAYER_FADE_DONE, .pixels = base_pixels},
+        {.opacity = 255, .blend = BLEND_REPLACE, .count = LED_NUMBER / 2, .fade_weight = LAYER_FADE_DONE, .pixels = overlay_pixels},
+        {.opacity = 255, .blend = BLEND_MULTIPLY, .solid = 1, .fade_weight = LAYER_FADE_DONE, .pixels = &master},
+    };
+    for(long i=0;i<n;++i) {
+        compositor_run(layers, sizeof(layers) / sizeof(layers[0]), out, LED_NUMBER, NULL);
+        sink += out[i % LED_NUMBER].green;
+    }
+}
+
+// two sources of a full universe, merged frame by frame
+static void run_merge(long n, uint8_t mode) {
+    uint8_t *merged;
+    for(long i=0;i<n;++i) {
+        sink += merge_frame(mode, 1 + (i & 1), UNIVERSE, dmx_packet + 18, 512, 0, &merged);
+    }
+}
+
+static void run_merge_htp(long n) {
+    run_merge(n, MERGE_HTP);
+}
+
+static void run_merge_ltp(long n) {
+    run_merge(n, MERGE_LTP);
+}
+
+// the scalar loops the SWAR kernels replaced, kept as the reference
+static uint32_t copy_rgb_scalar(ws2812_pixel_t *dst, const uint8_t *src, int count) {
+    uint32_t diff = 0;
+    for(int i=0;i<count;++i, src+=3) {
+        diff |= (dst[i].red ^ src[0]) | (dst[i].green ^ src[1]) | (dst[i].blue ^ src[2]);
+        dst[i].red   = src[0];
+        dst[i].green = src[1];
+        dst[i].blue  = src[2];
+    }
+    return diff;
+}
+
+static void tint_scalar(ws2812_pixel_t *px, int count, const ws2812_pixel_t *tint, uint8_t level) {
+    for(int i=0;i<count;++i) {
+        px[i].red = (uint8_t)((((uint16_t)px[i].red)*(255-level) + ((uint16_t)tint->red)*(level))/255);
+        px[i].green = (uint8_t)((((uint16_t)px[i].green)*(255-level) + ((uint16_t)tint->green)*(level))/255);
+        px[i].blue = (uint8_t)((((uint16_t)px[i].blue)*(255-level) + ((uint16_t)tint->blue)*(level))/255);
+    }
+}
+
+// every other frame changes, so the copy cannot be skipped
+static void run_dmx_copy_scalar(long n) {
+    for(long i=0;i<n;++i) {
+        straight[1 + (i & 1)] ^= 1;
+        sink += copy_rgb_scalar(out, straight + 1, LED_NUMBER);
+    }
+}
+
+static void run_dmx_copy_swar(long n) {
+    for(long i=0;i<n;++i) {
+        straight[1 + (i & 1)] ^= 1;
+        sink += swar_copy_rgb(out, straight + 1, LED_NUMBER);
+    }
+}
+
+static ws2812_pixel_t tint = {.red = 255, .green = 80, .blue = 0};
+
+static void run_tint_scalar(long n) {
+    for(long i=0;i<n;++i) {
+        tint_scalar(base_pixels, LED_NUMBER, &tint, i);
+        sink += base_pixels[0].red;
+    }
+}
+
+static void run_tint_swar(long n) {
+    for(long i=0;i<n;++i) {
+        swar_tint(base_pixels, LED_NUMBER, &tint, i);
+        sink += base_pixels[0].red;
+    }
+}
+
+static void run_wifi_settings(long n) {
+    static char settings[] = "home\0password\0office\0secret123\0stage\0\0backup\0hackmehackme";
+    for(long i=0;i<n;++i) {
+        struct station_settings_t *s = parse_binary_wifi_station_settings(settings, sizeof(settings));
+        sink += s[0].ssid[0];
+        free_wifi_station_settings(s);
+    }
+}
+
+static void setup_rainbow(uint8_t *payload, size_t len) {
+    ws2812_update(payload, len);
+    usleep(50000); // let the updater render once and go to sleep
+}
+
+struct baseline {
+    char name[64];
+    int leds;
+    double ns;
+};
+
+static struct baseline *baseline = NULL;
+static int baseline_count = 0;
+
+static int load_baseline(const char *path) {
+    char line[256];
+    FILE *f = fopen(path, "r");
+    if(!f) {
+        perror(path);
+        return -1;
+    }
+    while(fgets(line, sizeof(line), f)) {
+        struct baseline b;
+        if(sscanf(line, "%63[^,],%d,%lf", b.name, &b.leds, &b.ns) != 3) continue; // header or garbage
+        baseline = realloc(baseline, sizeof(struct baseline) * (baseline_count + 1));
+        baseline[baseline_count++] = b;
+    }
+    fclose(f);
+    return 0;
+}
+
+static const struct baseline *find_baseline(const char *name) {
+    for(int i=0;i<baseline_count;++i) {
+        if(baseline[i].leds == LED_NUMBER && !strcmp(baseline[i].name, name)) return &baseline[i];
+    }
+    return NULL;
+}
+
+/**
+ * Best of BATCHES batches, each running for about duration / BATCHES.
+ */
+static double measure(const struct bench *b, double duration) {
+    long n = 1;
+    double best = 0;
+    uint64_t t;
+
+    // calibrate the batch size
+    while(1) {
+        t = host_time_us();
+        b->run(n);
+        t = host_time_us() - t;
+        if(t >= duration * 1e6 / BATCHES / 4) break;
+        n *= 2;
+    }
+    n = n * (duration * 1e6 / BATCHES) / (t ? t : 1) + 1;
+    for(int i=0;i<BATCHES;++i) {
+        t = host_time_us();
+        b->run(n);
+        t = host_time_us() - t;
+        double ns = t * 1e3 / n;
+        if(i == 0 || ns < best) best = ns;
+    }
+    return best;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-n] [-d seconds] [-c BASELINE [-t percent]]\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    static const struct bench benches[] = {
+        {"parse_art_net_valid", run_parse_valid},
+        {"parse_art_net_wrong_universe", run_parse_wrong_universe},
+        {"parse_art_net_invalid", run_parse_invalid},
+        {"ws2812_update_straight", run_update_straight},
+        {"ws2812_update_chain", run_update_chain},
+        {"ws2812_update_chain_reversed", run_update_chain_reversed},
+        {"ws2812_update_rainbow", run_update_rainbow},
+        {"ws2812_update_shader", run_update_shader},
+        {"rainbow_render_rgb_tint", run_rainbow_rgb_tint},
+        {"rainbow_render_hsv_tint", run_rainbow_hsv_tint},
+        {"rgb2hsv", run_rgb2hsv},
+        {"hsv2rgb", run_hsv2rgb},
+        {"compositor_run" PROFILE_SUFFIX, run_compositor, true},
+        {"merge_frame_htp", run_merge_htp},
+        {"merge_frame_ltp", run_merge_ltp},
+        {"dmx_copy_scalar" PROFILE_SUFFIX, run_dmx_copy_scalar, true},
+        {"dmx_copy_swar" PROFILE_SUFFIX, run_dmx_copy_swar, true},
+        {"tint_blend_scalar", run_tint_scalar},
+        {"tint_blend_swar", run_tint_swar},
+        {"parse_binary_wifi_station_settings", run_wifi_settings},
+    };
+    const char *baseline_path = NULL;
+    double duration = 0.5, threshold = 10;
+    int header = 1, regressions = 0, opt;
+
+    while((opt = getopt(argc, argv, "nd:c:t:")) != -1) {
+        switch(opt) {
+        case 'n': header = 0; break;
+        case 'd': duration = atof(optarg); break;
+        case 'c': baseline_path = optarg; break;
+        case 't': threshold = atof(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if(optind != argc || duration <= 0) usage(argv[0]);
+    if(baseline_path && load_baseline(baseline_path) != 0) return 2;
+
+    fill_dmx(dmx_packet, UNIVERSE);
+    fill_dmx(dmx_wrong_universe, UNIVERSE + 1);
+    fill_dmx(not_art_net, UNIVERSE);
+    not_art_net[0] = 'X';
+    straight[0] = DMX_STRAIGHT;
+    for(size_t i=1;i<sizeof(straight);++i) straight[i] = i;
+    for(int i=0;i<LED_NUMBER;++i) {
+        base_pixels[i] = (ws2812_pixel_t){.red = i, .green = i * 3, .blue = i * 7};
+        overlay_pixels[i] = (ws2812_pixel_t){.red = 255 - i, .green = i * 5, .blue = 128};
+    }
+
+    monitor_init();
+    config_init();
+    config.dmx_universe = UNIVERSE;
+    ws2812_init();
+    init_server();
+    usleep(100000);
+
+    if(header) printf(baseline_path ? "benchmark,leds,ns_per_op,baseline_ns_per_op,change_percent,status\n"
+            : "benchmark,leds,ns_per_op\n");
+    for(size_t i=0;i<sizeof(benches)/sizeof(benches[0]);++i) {
+        const struct bench *b = &benches[i];
+        if(WS2812_PROFILE != WS2812_PROFILE_GRB && !b->per_profile) continue;
+        if(b->run == run_rainbow_rgb_tint) setup_rainbow(rainbow_rgb, sizeof(rainbow_rgb));
+        if(b->run == run_rainbow_hsv_tint) setup_rainbow(rainbow_hsv, sizeof(rainbow_hsv));
+        double ns = measure(b, duration);
+        if(!baseline_path) {
+            printf("%s,%d,%.1f\n", b->name, LED_NUMBER, ns);
+            continue;
+        }
+        const struct baseline *base = find_baseline(b->name);
+        if(!base) {
+            printf("%s,%d,%.1f,,,NEW\n", b->name, LED_NUMBER, ns);
+            continue;
+        }
+        double change = (ns - base->ns) * 100 / base->ns;
+        int regression = change > threshold;
+        regressions += regression;
+        printf("%s,%d,%.1f,%.1f,%+.1f,%s\n", b->name, LED_NUMBER, ns, base->ns, change,
+                regression ? "REGRESSION" : change < -threshold ? "IMPROVED" : "OK");
+        fflush(stdout);
+    }
+    fprintf(stderr, "checksum %u\n", sink);
+    return regressions ? 1 : 0;
+}
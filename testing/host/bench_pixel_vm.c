@@ -0,0 +1,94 @@
+/*
+ * bench_pixel_vm.c
+ *
+ * Host benchmark for pixel_vm: reports rendered pixels per second for each sample program.
+ * Usage: bench_pixel_vm [pixels [seconds]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "pixel_vm.h"
+
+struct sample {
+    const char *name;
+    const uint8_t *code;
+    size_t len;
+};
+
+// r, g, b = params 0..2
+static const uint8_t solid[] = {
+    PVM_END,
+    PVM_PARAM, 0, PVM_PARAM, 1, PVM_PARAM, 2,
+};
+
+// linear red to blue gradient along the strip
+static const uint8_t gradient[] = {
+    PVM_END,
+    PVM_INDEX, PVM_PUSH8, 255, PVM_MUL, PVM_COUNT, PVM_DIV, PVM_DUP,
+    PVM_PUSH8, 255, PVM_SWAP, PVM_SUB, PVM_SWAP,
+    PVM_PUSH8, 0, PVM_SWAP,
+};
+
+// rainbow: hue = time * param0 / 256 + index * param1
+static const uint8_t rainbow[] = {
+    PVM_TIME, PVM_PARAM, 0, PVM_MUL, PVM_PUSH8, 8, PVM_SHR, PVM_STORE, 0,
+    PVM_END,
+    PVM_LOAD, 0, PVM_INDEX, PVM_PARAM, 1, PVM_MUL, PVM_ADD,
+    PVM_PUSH8, 255, PVM_PUSH8, 255, PVM_HSV,
+};
+
+// plasma: two sine waves moving in opposite directions
+static const uint8_t plasma[] = {
+    PVM_TIME, PVM_PUSH8, 2, PVM_SHR, PVM_STORE, 0,
+    PVM_END,
+    PVM_INDEX, PVM_PUSH8, 3, PVM_SHL, PVM_LOAD, 0, PVM_ADD, PVM_SIN8,
+    PVM_DUP, PVM_PUSH8, 255, PVM_SWAP, PVM_SUB,
+    PVM_INDEX, PVM_PUSH8, 4, PVM_SHL, PVM_LOAD, 0, PVM_SUB, PVM_SIN8,
+};
+
+#define SAMPLE(x) {#x, x, sizeof(x)}
+static const struct sample samples[] = {
+    SAMPLE(solid),
+    SAMPLE(gradient),
+    SAMPLE(rainbow),
+    SAMPLE(plasma),
+};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 512;
+    double duration = argc > 2 ? atof(argv[2]) : 0.5;
+    ws2812_pixel_t *pixels = malloc(sizeof(ws2812_pixel_t) * count);
+    struct pixel_vm_program prog;
+    struct pixel_vm_state state = {.params = {200, 100, 50}};
+    uint32_t checksum = 0;
+
+    printf("program,bytes,pixels,pixels_per_second\n");
+    for(size_t s=0;s<sizeof(samples)/sizeof(samples[0]);++s) {
+        if(pixel_vm_load(&prog, samples[s].code, samples[s].len) != 0) {
+            fprintf(stderr, "%s: validation failed\n", samples[s].name);
+            return 1;
+        }
+        long frames = 0;
+        double begin = now(), elapsed;
+        do {
+            for(int i=0;i<64;++i, ++frames) {
+                pixel_vm_frame(&prog, &state, frames * 25, count);
+                pixel_vm_render(&prog, &state, pixels, count);
+                checksum += pixels[frames % count].red;
+            }
+            elapsed = now() - begin;
+        } while(elapsed < duration);
+        printf("%s,%d,%d,%.0f\n", samples[s].name, (int)samples[s].len, count, frames * count / elapsed);
+    }
+    fprintf(stderr, "checksum %u\n", checksum);
+    free(pixels);
+    return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * capture.c
+ *
+ * Art-Net capture file reading and writing, see capture.h
+ */
+#include <string.h>
+
+#include "capture.h"
+
+#define RECORD_HEADER 16
+
+static void put_le(uint8_t *buf, uint64_t v, int n) {
+    for(int i=0;i<n;++i, v>>=8) buf[i] = v & 0xff;
+}
+
+static uint64_t get_le(const uint8_t *buf, int n) {
+    uint64_t v = 0;
+    for(int i=n-1;i>=0;--i) v = (v << 8) | buf[i];
+    return v;
+}
+
+int capture_write_header(FILE *f) {
+    uint8_t buf[sizeof(CAPTURE_MAGIC) + 2];
+    memcpy(buf, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    put_le(buf + sizeof(CAPTURE_MAGIC), CAPTURE_VERSION, 2);
+    return fwrite(buf, sizeof(buf), 1, f) == 1 ? 0 : -1;
+}
+
+int capture_read_header(FILE *f) {
+    uint8_t buf[sizeof(CAPTURE_MAGIC) + 2];
+    if(fread(buf, sizeof(buf), 1, f) != 1) return -1;
+    if(memcmp(buf, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC))) return -2;
+    if(get_le(buf + sizeof(CAPTURE_MAGIC), 2) != CAPTURE_VERSION) return -3;
+    return 0;
+}
+
+int capture_write(FILE *f, const struct capture_record *rec) {
+    uint8_t buf[RECORD_HEADER];
+    put_le(buf, rec->time_us, 8);
+    memcpy(buf + 8, &rec->source_ip, 4);
+    put_le(buf + 12, rec->source_port, 2);
+    put_le(buf + 14, rec->len, 2);
+    if(fwrite(buf, sizeof(buf), 1, f) != 1) return -1;
+    if(rec->len && fwrite(rec->data, rec->len, 1, f) != 1) return -1;
+    return 0;
+}
+
+int capture_read(FILE *f, struct capture_record *rec) {
+    uint8_t buf[RECORD_HEADER];
+    size_t got = fread(buf, 1, sizeof(buf), f);
+    if(got == 0) return 0;
+    if(got != sizeof(buf)) return -1;
+    rec->time_us = get_le(buf, 8);
+    memcpy(&rec->source_ip, buf + 8, 4);
+    rec->source_port = get_le(buf + 12, 2);
+    rec->len = get_le(buf + 14, 2);
+    if(rec->len > CAPTURE_MAX_DATAGRAM) return -2;
+    if(rec->len && fread(rec->data, rec->len, 1, f) != 1) return -1;
+    return 1;
+}
@@ -0,0 +1,42 @@
+/*
+ * capture.h
+ *
+ * Art-Net capture file format used by artnet_capture and artnet_replay.
+ * All fields are little-endian:
+ *   file:   MAGIC("ANCAP\0") + VERSION(2 bytes) + records
+ *   record: TIME(8 bytes, us since capture start) + SOURCE_IP(4 bytes, network order)
+ *           + SOURCE_PORT(2 bytes) + LENGTH(2 bytes) + DATAGRAM(LENGTH bytes)
+ */
+
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define CAPTURE_MAGIC "ANCAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_MAX_DATAGRAM 1500
+
+struct capture_record {
+    uint64_t time_us;
+    uint32_t source_ip;
+    uint16_t source_port;
+    uint16_t len;
+    uint8_t data[CAPTURE_MAX_DATAGRAM];
+};
+
+/**
+ * Writes or checks the file header, returns 0 on success.
+ */
+int capture_write_header(FILE *f);
+int capture_read_header(FILE *f);
+
+int capture_write(FILE *f, const struct capture_record *rec);
+
+/**
+ * Returns 1 if a record was read, 0 at the end of file, negative on a broken file.
+ */
+int capture_read(FILE *f, struct capture_record *rec);
+
+#endif /* CAPTURE_H_ */
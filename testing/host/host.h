@@ -0,0 +1,39 @@
+/*
+ * host.h
+ *
+ * Host build only: hooks into the shimmed SDK, see host_rtos.c
+ */
+
+#ifndef HOST_H_
+#define HOST_H_
+
+#include <stdint.h>
+
+#include "color_conv.h"
+
+/**
+ * Called from ws2812_i2s_update with the frame sent to the virtual strip.
+ */
+typedef void (*host_strip_cb_t)(const ws2812_pixel_t *pixels, int count, void *arg);
+
+void host_strip_set_callback(host_strip_cb_t cb, void *arg);
+uint32_t host_strip_frames();
+
+/**
+ * Monotonic time in microseconds since the process start, same clock as sdk_system_get_time but 64-bit.
+ */
+uint64_t host_time_us();
+
+/**
+ * Moves the sockets the firmware binds, for several instances in one process (see artnet_swarm.c):
+ * port_offset is added to their ports and, unless ip is 0, they are bound to ip (network byte order)
+ * instead of any address. Must be called before the servers start.
+ */
+void host_node_address(uint32_t ip, int port_offset);
+
+/**
+ * CPU time in microseconds spent by the tasks of the firmware.
+ */
+uint64_t host_cpu_us();
+
+#endif /* HOST_H_ */
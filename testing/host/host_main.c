@@ -0,0 +1,47 @@
+/*
+ * host_main.c
+ *
+ * Firmware running on Linux: Art-Net server and renderer on top of host_rtos.c,
+ * the strip is virtual and only counts frames.
+ * Usage: artnet2ws2812_host [universe [shift]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "FreeRTOS.h"
+
+#include "ws2812.h"
+#include "art_net.h"
+#include "sacn.h"
+#include "monitor.h"
+#include "config.h"
+#include "timesync.h"
+#include "host.h"
+
+int main(int argc, char **argv) {
+    monitor_init();
+    config_init();
+    if(argc > 1) config.dmx_universe = atoi(argv[1]);
+    if(argc > 2) config.dmx_shift = atoi(argv[2]);
+
+    ws2812_init();
+    init_server();
+    init_sacn_server();
+    timesync_init();
+    printf("Listening on port %d, %d pixels\n", ART_NET_PORT, LED_NUMBER);
+
+    uint32_t frames = host_strip_frames();
+    uint64_t t = host_time_us();
+    while(1) {
+        sleep(1);
+        uint32_t f = host_strip_frames();
+        uint64_t now = host_time_us();
+        printf("fps %.1f\n", (f - frames) * 1e6 / (now - t));
+        fflush(stdout);
+        frames = f;
+        t = now;
+    }
+    return 0;
+}
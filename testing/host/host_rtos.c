@@ -0,0 +1,371 @@
+/*
+ * host_rtos.c
+ *
+ * FreeRTOS, sysparam and SDK subset used by the firmware, implemented on pthreads for the host build.
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "event_groups.h"
+#include "sysparam.h"
+#include "espressif/esp_common.h"
+#include "ws2812_i2s/ws2812_i2s.h"
+
+#include "host.h"
+
+static uint64_t boot_us;
+
+static uint64_t monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* the SDK clock starts at boot */
+__attribute__((constructor)) static void host_boot() {
+    boot_us = monotonic_us();
+}
+
+uint64_t host_time_us() {
+    return monotonic_us() - boot_us;
+}
+
+static void deadline(struct timespec *ts, clockid_t clock, TickType_t ticks) {
+    uint64_t ns = (uint64_t)ticks * portTICK_PERIOD_MS * 1000000;
+    clock_gettime(clock, ts);
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+}
+
+/* tasks */
+
+#define HOST_MAX_TASKS 16
+
+struct host_task {
+    pthread_t thread;
+    TaskFunction_t code;
+    void *params;
+    char name[16];
+};
+
+static __thread struct host_task *current_task = NULL;
+static struct host_task *tasks[HOST_MAX_TASKS]; // for the CPU time
+static int tasks_count = 0;
+static pthread_mutex_t tasks_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *task_main(void *arg) {
+    current_task = arg;
+    current_task->code(current_task->params);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint16_t stack_depth,
+        void *params, UBaseType_t priority, TaskHandle_t *handle) {
+    struct host_task *task = calloc(1, sizeof(struct host_task));
+    task->code = code;
+    task->params = params;
+    strncpy(task->name, name, sizeof(task->name) - 1);
+    if(pthread_create(&task->thread, NULL, task_main, task) != 0) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    pthread_mutex_lock(&tasks_mutex);
+    if(tasks_count < HOST_MAX_TASKS) tasks[tasks_count++] = task;
+    pthread_mutex_unlock(&tasks_mutex);
+    if(handle) *handle = task;
+    return pdPASS;
+}
+
+uint64_t host_cpu_us() {
+    uint64_t us = 0;
+    struct timespec ts;
+    clockid_t clock;
+    pthread_mutex_lock(&tasks_mutex);
+    for(int i=0;i<tasks_count;++i) {
+        if(pthread_getcpuclockid(tasks[i]->thread, &clock) == 0 && clock_gettime(clock, &ts) == 0) {
+            us += (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        }
+    }
+    pthread_mutex_unlock(&tasks_mutex);
+    return us;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if(task == NULL || task == current_task) pthread_exit(NULL);
+    pthread_cancel(task->thread);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    struct timespec ts;
+    deadline(&ts, CLOCK_MONOTONIC, ticks);
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return host_time_us() / 1000 / portTICK_PERIOD_MS;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    return 0;
+}
+
+const char *pcTaskGetName(TaskHandle_t task) {
+    if(!task) task = current_task;
+    return task ? task->name : "main";
+}
+
+/* critical sections exclude the other tasks only, there are no interrupts */
+static pthread_mutex_t critical_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void vTaskEnterCritical(void) {
+    pthread_mutex_lock(&critical_mutex);
+}
+
+void vTaskExitCritical(void) {
+    pthread_mutex_unlock(&critical_mutex);
+}
+
+size_t xPortGetFreeHeapSize(void) {
+    return 0;
+}
+
+size_t xPortGetMinimumEverFreeHeapSize(void) {
+    return 0;
+}
+
+/* mutexes */
+
+struct host_mutex {
+    pthread_mutex_t mutex;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    struct host_mutex *sem = malloc(sizeof(struct host_mutex));
+    pthread_mutex_init(&sem->mutex, NULL);
+    return sem;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+    struct timespec ts;
+    if(ticks == portMAX_DELAY) return pthread_mutex_lock(&sem->mutex) == 0;
+    deadline(&ts, CLOCK_REALTIME, ticks);
+    return pthread_mutex_timedlock(&sem->mutex, &ts) == 0;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    return pthread_mutex_unlock(&sem->mutex) == 0;
+}
+
+/* event groups */
+
+struct host_event_group {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void) {
+    struct host_event_group *group = malloc(sizeof(struct host_event_group));
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&group->mutex, NULL);
+    pthread_cond_init(&group->cond, &attr);
+    group->bits = 0;
+    return group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    pthread_mutex_lock(&group->mutex);
+    group->bits |= bits;
+    bits = group->bits;
+    pthread_cond_broadcast(&group->cond);
+    pthread_mutex_unlock(&group->mutex);
+    return bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    EventBits_t ret;
+    pthread_mutex_lock(&group->mutex);
+    ret = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->mutex);
+    return ret;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+        BaseType_t clear_on_exit, BaseType_t wait_for_all, TickType_t ticks) {
+    struct timespec ts;
+    EventBits_t ret;
+    int err = 0;
+
+    deadline(&ts, CLOCK_MONOTONIC, ticks == portMAX_DELAY ? 1000000 : ticks);
+    pthread_mutex_lock(&group->mutex);
+    while(err == 0) {
+        EventBits_t set = group->bits & bits;
+        if(wait_for_all ? set == bits : set != 0) break;
+        if(ticks == portMAX_DELAY) err = pthread_cond_wait(&group->cond, &group->mutex);
+        else err = pthread_cond_timedwait(&group->cond, &group->mutex, &ts);
+    }
+    ret = group->bits;
+    if(err == 0 && clear_on_exit) group->bits &= ~bits;
+    pthread_mutex_unlock(&group->mutex);
+    return ret;
+}
+
+/* sysparam, kept in memory */
+
+struct param {
+    struct param *next;
+    char *key;
+    uint8_t *value;
+    size_t len;
+    bool is_binary;
+};
+
+static struct param *params = NULL;
+static pthread_mutex_t params_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct param *find_param(const char *key) {
+    for(struct param *p=params;p;p=p->next) {
+        if(!strcmp(p->key, key)) return p;
+    }
+    return NULL;
+}
+
+sysparam_status_t sysparam_get_data(const char *key, uint8_t **destptr, size_t *actual_length, bool *is_binary) {
+    sysparam_status_t ret = SYSPARAM_NOTFOUND;
+    pthread_mutex_lock(&params_mutex);
+    struct param *p = find_param(key);
+    *destptr = NULL;
+    if(p) {
+        *destptr = malloc(p->len + 1);
+        memcpy(*destptr, p->value, p->len);
+        (*destptr)[p->len] = 0;
+        if(actual_length) *actual_length = p->len;
+        if(is_binary) *is_binary = p->is_binary;
+        ret = SYSPARAM_OK;
+    }
+    pthread_mutex_unlock(&params_mutex);
+    return ret;
+}
+
+sysparam_status_t sysparam_set_data(const char *key, const uint8_t *value, size_t value_len, bool is_binary) {
+    pthread_mutex_lock(&params_mutex);
+    struct param *p = find_param(key);
+    if(!p) {
+        p = calloc(1, sizeof(struct param));
+        p->key = strdup(key);
+        p->next = params;
+        params = p;
+    }
+    free(p->value);
+    p->value = malloc(value_len ? value_len : 1);
+    memcpy(p->value, value, value_len);
+    p->len = value_len;
+    p->is_binary = is_binary;
+    pthread_mutex_unlock(&params_mutex);
+    return SYSPARAM_OK;
+}
+
+sysparam_status_t sysparam_get_string(const char *key, char **destptr) {
+    return sysparam_get_data(key, (uint8_t **)destptr, NULL, NULL);
+}
+
+sysparam_status_t sysparam_set_string(const char *key, const char *value) {
+    return sysparam_set_data(key, (const uint8_t *)value, strlen(value), false);
+}
+
+#define SYSPARAM_INT(type) \
+sysparam_status_t sysparam_get_##type(const char *key, type##_t *result) {\
+    uint8_t *value;\
+    size_t len;\
+    sysparam_status_t ret = sysparam_get_data(key, &value, &len, NULL);\
+    if(ret != SYSPARAM_OK) return ret;\
+    if(len == sizeof(type##_t)) memcpy(result, value, len);\
+    else ret = SYSPARAM_PARSEFAILED;\
+    free(value);\
+    return ret;\
+}\
+sysparam_status_t sysparam_set_##type(const char *key, type##_t value) {\
+    return sysparam_set_data(key, (const uint8_t *)&value, sizeof(value), true);\
+}
+
+SYSPARAM_INT(int8)
+SYSPARAM_INT(int32)
+
+/* SDK */
+
+uint32_t sdk_system_get_time(void) {
+    return host_time_us();
+}
+
+uint32_t sdk_system_get_chip_id(void) {
+    return getpid();
+}
+
+char *host_inet_ntoa_r(const void *addr, char *buf, int buflen) {
+    return (char *)inet_ntop(AF_INET, addr, buf, buflen);
+}
+
+/* address of the instance */
+
+static uint32_t node_ip = 0;
+static int node_port_offset = 0;
+
+void host_node_address(uint32_t ip, int port_offset) {
+    node_ip = ip;
+    node_port_offset = port_offset;
+}
+
+int host_bind(int sock, const struct sockaddr *addr, socklen_t len) {
+    struct sockaddr_in in;
+    if(addr->sa_family != AF_INET || len < sizeof(in)) return bind(sock, addr, len);
+    memcpy(&in, addr, sizeof(in));
+    if(node_ip && in.sin_addr.s_addr == htonl(INADDR_ANY)) in.sin_addr.s_addr = node_ip;
+    in.sin_port = htons(ntohs(in.sin_port) + node_port_offset);
+    return bind(sock, (const struct sockaddr *)&in, sizeof(in));
+}
+
+/* virtual strip */
+
+static host_strip_cb_t strip_cb = NULL;
+static void *strip_cb_arg = NULL;
+static uint32_t strip_pixels = 0;
+static uint32_t strip_frames = 0;
+
+void host_strip_set_callback(host_strip_cb_t cb, void *arg) {
+    strip_cb_arg = arg;
+    strip_cb = cb;
+}
+
+uint32_t host_strip_frames() {
+    return strip_frames;
+}
+
+void ws2812_i2s_init(uint32_t pixels_number, pixeltype_t type) {
+    strip_pixels = pixels_number;
+}
+
+void ws2812_i2s_update(ws2812_pixel_t *pixels, pixeltype_t type) {
+    ++strip_frames;
+    if(strip_cb) strip_cb(pixels, strip_pixels, strip_cb_arg);
+}
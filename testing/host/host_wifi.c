@@ -0,0 +1,19 @@
+/*
+ * host_wifi.c
+ *
+ * Wi-Fi settings commands of the host build, there is no radio to configure.
+ */
+#include <stdio.h>
+#include <stddef.h>
+
+#include "wifi.h"
+
+int update_wifi_station_settings(char* buf, size_t len) {
+    printf("Ignoring station settings of %d bytes\n", (int)len);
+    return 0;
+}
+
+int update_wifi_ap_settings(char* buf, size_t len) {
+    printf("Ignoring AP settings of %d bytes\n", (int)len);
+    return 0;
+}
@@ -0,0 +1 @@
+/* host shim: nothing to configure */
@@ -0,0 +1,25 @@
+/*
+ * esp_common.h
+ *
+ * Host shim, implemented in host_rtos.c
+ */
+#ifndef HOST_ESP_COMMON_H_
+#define HOST_ESP_COMMON_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define BIT(n) (1UL << (n))
+#define BIT0 BIT(0)
+#define BIT1 BIT(1)
+#define BIT2 BIT(2)
+#define BIT3 BIT(3)
+#define BIT4 BIT(4)
+#define BIT5 BIT(5)
+#define BIT6 BIT(6)
+#define BIT7 BIT(7)
+
+uint32_t sdk_system_get_time(void);
+uint32_t sdk_system_get_chip_id(void);
+
+#endif /* HOST_ESP_COMMON_H_ */
@@ -0,0 +1,21 @@
+/*
+ * event_groups.h
+ *
+ * Host shim, implemented in host_rtos.c
+ */
+#ifndef HOST_EVENT_GROUPS_H_
+#define HOST_EVENT_GROUPS_H_
+
+#include "FreeRTOS.h"
+
+typedef uint32_t EventBits_t;
+typedef struct host_event_group *EventGroupHandle_t;
+
+EventGroupHandle_t xEventGroupCreate(void);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+        BaseType_t clear_on_exit, BaseType_t wait_for_all, TickType_t ticks);
+
+#endif /* HOST_EVENT_GROUPS_H_ */
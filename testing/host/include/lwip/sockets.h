@@ -0,0 +1,23 @@
+/*
+ * sockets.h
+ *
+ * Host shim, implemented in host_rtos.c
+ */
+#ifndef HOST_LWIP_SOCKETS_H_
+#define HOST_LWIP_SOCKETS_H_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <unistd.h>
+
+char *host_inet_ntoa_r(const void *addr, char *buf, int buflen);
+#define inet_ntoa_r(addr, buf, buflen) host_inet_ntoa_r(&(addr), (buf), (buflen))
+
+/* binds to the address of the instance, see host_node_address in host.h */
+int host_bind(int sock, const struct sockaddr *addr, socklen_t len);
+#define bind(sock, addr, len) host_bind((sock), (addr), (len))
+
+#endif /* HOST_LWIP_SOCKETS_H_ */
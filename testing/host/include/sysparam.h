@@ -0,0 +1,33 @@
+/*
+ * sysparam.h
+ *
+ * Host shim, implemented in host_rtos.c
+ */
+#ifndef HOST_SYSPARAM_H_
+#define HOST_SYSPARAM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef enum {
+    SYSPARAM_OK          = 0,
+    SYSPARAM_NOTFOUND    = 1,
+    SYSPARAM_PARSEFAILED = 2,
+    SYSPARAM_ERR_NOMEM   = -1,
+    SYSPARAM_ERR_CORRUPT = -2,
+    SYSPARAM_ERR_IO      = -3,
+    SYSPARAM_ERR_FULL    = -4,
+    SYSPARAM_ERR_BADVALUE = -5,
+} sysparam_status_t;
+
+sysparam_status_t sysparam_get_data(const char *key, uint8_t **destptr, size_t *actual_length, bool *is_binary);
+sysparam_status_t sysparam_set_data(const char *key, const uint8_t *value, size_t value_len, bool is_binary);
+sysparam_status_t sysparam_get_string(const char *key, char **destptr);
+sysparam_status_t sysparam_set_string(const char *key, const char *value);
+sysparam_status_t sysparam_get_int8(const char *key, int8_t *result);
+sysparam_status_t sysparam_set_int8(const char *key, int8_t value);
+sysparam_status_t sysparam_get_int32(const char *key, int32_t *result);
+sysparam_status_t sysparam_set_int32(const char *key, int32_t value);
+
+#endif /* HOST_SYSPARAM_H_ */
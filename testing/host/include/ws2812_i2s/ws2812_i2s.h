@@ -0,0 +1,20 @@
+/*
+ * ws2812_i2s.h
+ *
+ * Host shim, implemented in host_rtos.c
+ */
+#ifndef HOST_WS2812_I2S_H_
+#define HOST_WS2812_I2S_H_
+
+#include <stdint.h>
+#include "color_conv.h"
+
+typedef enum {
+    PIXEL_RGB = 12,
+    PIXEL_RGBW = 16
+} pixeltype_t;
+
+void ws2812_i2s_init(uint32_t pixels_number, pixeltype_t type);
+void ws2812_i2s_update(ws2812_pixel_t *pixels, pixeltype_t type);
+
+#endif /* HOST_WS2812_I2S_H_ */
@@ -0,0 +1,143 @@
+/*
+ * wifi_fsm_sim.c
+ *
+ * Runs wifi_fsm against simulated stations in virtual time and prints the timeline
+ * and the time it took to connect.
+ * Usage: wifi_fsm_sim [options] STATION...
+ *   STATION      RSSI:RESULT:MS, RSSI is -dBm (70 for -70 dBm) or x if the scan doesn't see it,
+ *                RESULT is ok, fail or hang (never answers), MS is the time to the result
+ *   -p INDEX     station with a cached BSSID, connected without a scan (-1)
+ *   -s MS        scan duration (2200)
+ *   -l MS        drop the connection this long after it is made, once (never)
+ *   -t MS        give up after (120000)
+ * Example: wifi_fsm_sim -p 0 x:hang:0 80:ok:3000 60:fail:1500
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "wifi_fsm.h"
+#include "wifi.h"
+
+enum { RESULT_OK, RESULT_FAIL, RESULT_HANG };
+
+struct station {
+    int8_t rssi;
+    int result;
+    uint32_t ms;
+};
+
+#define NEVER UINT32_MAX
+
+static struct station stations[WIFI_FSM_MAX_STATIONS];
+static int count = 0;
+static uint32_t scan_ms = 2200, lose_ms = NEVER, limit_ms = 120000;
+
+static uint32_t scan_at = NEVER, result_at = NEVER, lose_at = NEVER;
+static int scans = 0, attempts = 0;
+
+static int parse_station(const char *arg, struct station *s) {
+    char rssi[8], result[8];
+    unsigned ms;
+    if(sscanf(arg, "%7[^:]:%7[^:]:%u", rssi, result, &ms) != 3) return -1;
+    s->rssi = strcmp(rssi, "x") ? -atoi(rssi) : WIFI_FSM_NO_RSSI;
+    if(!strcmp(result, "ok")) s->result = RESULT_OK;
+    else if(!strcmp(result, "fail")) s->result = RESULT_FAIL;
+    else if(!strcmp(result, "hang")) s->result = RESULT_HANG;
+    else return -1;
+    s->ms = ms;
+    return 0;
+}
+
+static void run(struct wifi_fsm *fsm, int actions, uint32_t now) {
+    if(actions & WIFI_ACT_AP_ON) printf("%8u AP on\n", now);
+    if(actions & WIFI_ACT_AP_OFF) printf("%8u AP off\n", now);
+    if(actions & WIFI_ACT_SCAN) {
+        printf("%8u scan\n", now);
+        ++scans;
+        scan_at = now + scan_ms;
+        result_at = NEVER;
+    }
+    if(actions & WIFI_ACT_CONNECT) {
+        struct station *s = &stations[fsm->station];
+        printf("%8u connect %d%s\n", now, fsm->station, fsm->direct ? " directly" : "");
+        ++attempts;
+        result_at = s->result == RESULT_HANG ? NEVER : now + s->ms;
+    }
+}
+
+static uint32_t min_time(uint32_t a, uint32_t b) {
+    return a < b ? a : b;
+}
+
+int main(int argc, char **argv) {
+    int opt, preferred = -1, i;
+    uint32_t now = 0, connected_at = NEVER;
+    int8_t rssi[WIFI_FSM_MAX_STATIONS];
+    struct wifi_fsm fsm;
+
+    while((opt = getopt(argc, argv, "p:s:l:t:")) != -1) {
+        switch(opt) {
+        case 'p': preferred = atoi(optarg); break;
+        case 's': scan_ms = atoi(optarg); break;
+        case 'l': lose_ms = atoi(optarg); break;
+        case 't': limit_ms = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-p INDEX] [-s MS] [-l MS] [-t MS] RSSI:ok|fail|hang:MS...\n", argv[0]);
+            return 2;
+        }
+    }
+    for(i=optind;i<argc && count<WIFI_FSM_MAX_STATIONS;++i, ++count) {
+        if(parse_station(argv[i], &stations[count]) != 0) {
+            fprintf(stderr, "Bad station %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    run(&fsm, wifi_fsm_start(&fsm, count, preferred, now), now);
+    while(now < limit_ms) {
+        int32_t wait = wifi_fsm_wait(&fsm, now);
+        uint32_t next = min_time(min_time(scan_at, result_at), lose_at);
+        if(wait >= 0) next = min_time(next, now + wait);
+        if(next == NEVER) break;
+        now = next;
+
+        if(now == scan_at) {
+            scan_at = NEVER;
+            for(i=0;i<count;++i) rssi[i] = stations[i].rssi;
+            printf("%8u scan done\n", now);
+            run(&fsm, wifi_fsm_scan_done(&fsm, rssi, now), now);
+        }
+        if(now == result_at) {
+            result_at = NEVER;
+            if(stations[fsm.station].result == RESULT_OK) {
+                printf("%8u got IP from %d\n", now, fsm.station);
+                if(connected_at == NEVER) connected_at = now;
+                if(lose_ms != NEVER) {
+                    lose_at = now + lose_ms;
+                    lose_ms = NEVER;
+                }
+                run(&fsm, wifi_fsm_got_ip(&fsm, now), now);
+            } else {
+                printf("%8u %d failed\n", now, fsm.station);
+                run(&fsm, wifi_fsm_fail(&fsm, now), now);
+            }
+        }
+        if(now == lose_at) {
+            lose_at = NEVER;
+            connected_at = NEVER;
+            printf("%8u lost %d\n", now, fsm.station);
+            run(&fsm, wifi_fsm_fail(&fsm, now), now);
+        }
+        run(&fsm, wifi_fsm_poll(&fsm, now), now);
+        if(fsm.state == WIFI_FSM_CONNECTED && lose_at == NEVER) break;
+    }
+    if(fsm.state == WIFI_FSM_CONNECTED) {
+        printf("connected to %d at %u ms, scans: %d, attempts: %d\n", fsm.station, connected_at, scans, attempts);
+        return 0;
+    }
+    printf("not connected after %u ms, scans: %d, attempts: %d\n", now, scans, attempts);
+    return 1;
+}
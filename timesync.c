@@ -0,0 +1,224 @@
+/*
+ * timesync.c
+ *
+ * Shared clock, see timesync.h
+ */
+#include "espressif/esp_common.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "timesync.h"
+#include "art_net.h"
+#include "config.h"
+#include "monitor.h"
+#include "logger.h"
+
+static const char* TAG = "timesync";
+
+enum {
+    TIMESYNC_REQUEST = 0, // T1
+    TIMESYNC_REPLY,       // T1 + T2 + T3
+    TIMESYNC_MASTER,      // IP
+};
+
+struct sample {
+    uint64_t local; // us, when the answer came
+    int64_t offset; // us, shared - local
+    uint32_t delay; // us, round trip
+};
+
+static SemaphoreHandle_t timesync_lock;
+static struct sample samples[TIMESYNC_SAMPLES];
+static int samples_count = 0, samples_next = 0;
+static uint64_t request_t1 = 0; // local time of the request waiting for an answer
+static uint64_t used_local = 0; // the sample the clock is set from
+static struct sample drift_from; // the sample the drift is measured from
+
+// clock model: shared = local + offset + (local - ref_local) * drift_ppb / 1e9
+static uint64_t ref_local = 0;
+static int64_t ref_offset = 0;
+static int32_t drift_ppb = 0;
+
+static uint32_t clock_high = 0, clock_last = 0;
+
+/**
+ * Extends the SDK clock to 64 bits, must be called with interrupts off.
+ * The task calls it often enough to see every wrap.
+ */
+static uint64_t local_us_isr() {
+    uint32_t now = sdk_system_get_time();
+    if(now < clock_last) ++clock_high;
+    clock_last = now;
+    return (uint64_t)clock_high << 32 | now;
+}
+
+static uint64_t local_us() {
+    uint64_t t;
+    taskENTER_CRITICAL();
+    t = local_us_isr();
+    taskEXIT_CRITICAL();
+    return t;
+}
+
+uint64_t timesync_now_us() {
+    uint64_t local, ref;
+    int64_t offset;
+    int32_t drift;
+    taskENTER_CRITICAL();
+    local = local_us_isr();
+    ref = ref_local;
+    offset = ref_offset;
+    drift = drift_ppb;
+    taskEXIT_CRITICAL();
+    return local + offset + (int64_t)(local - ref) * drift / 1000000000;
+}
+
+static uint8_t *put_be64(uint8_t *p, uint64_t v) {
+    for(int i=7;i>=0;--i) *(p++) = v >> (8 * i);
+    return p;
+}
+
+static uint64_t get_be64(uint8_t *p) {
+    uint64_t v = 0;
+    for(int i=0;i<8;++i) v = v << 8 | p[i];
+    return v;
+}
+
+/**
+ * Sets the clock from the sample, must be called with timesync_lock taken.
+ */
+static void use_sample(const struct sample *s) {
+    int64_t error, span;
+    int32_t drift = drift_ppb;
+
+    error = s->offset - (ref_offset + (int64_t)(s->local - ref_local) * drift_ppb / 1000000000);
+    if(!used_local || error > TIMESYNC_STEP * 1000 || error < -TIMESYNC_STEP * 1000) {
+        LOGI("Clock set, offset %d ms", (int)(s->offset / 1000));
+        drift = 0;
+        drift_from = *s;
+        // older samples were taken against another clock
+        samples[0] = *s;
+        samples_count = 1;
+        samples_next = 1 % TIMESYNC_SAMPLES;
+    } else if((span = s->local - drift_from.local) >= TIMESYNC_DRIFT_SPAN * 1000LL) {
+        // measured over the span, smoothed against the jitter of single samples
+        int64_t measured = (s->offset - drift_from.offset) * 1000000000 / span;
+        drift += (measured - drift) / 2;
+        if(drift > TIMESYNC_MAX_DRIFT * 1000) drift = TIMESYNC_MAX_DRIFT * 1000;
+        if(drift < -TIMESYNC_MAX_DRIFT * 1000) drift = -TIMESYNC_MAX_DRIFT * 1000;
+        drift_from = *s;
+        LOGD("Drift %d ppb, error %d us", drift, (int)error);
+    }
+    used_local = s->local;
+    taskENTER_CRITICAL();
+    ref_local = s->local;
+    ref_offset = s->offset;
+    drift_ppb = drift;
+    taskEXIT_CRITICAL();
+}
+
+static int handle_reply(uint8_t *buf, size_t len, uint32_t arrival_us) {
+    // the time the answer waited in the queues is not on the network
+    uint64_t t1, t2, t3, t4 = local_us() - (uint32_t)(sdk_system_get_time() - arrival_us);
+    struct sample *best;
+    int64_t delay;
+
+    if(len < 24) return -1;
+    t1 = get_be64(buf);
+    t2 = get_be64(buf + 8);
+    t3 = get_be64(buf + 16);
+    if(t1 != request_t1) {
+        LOGD("Stale answer");
+        return 0;
+    }
+    request_t1 = 0;
+    delay = (int64_t)(t4 - t1) - (int64_t)(t3 - t2);
+    if(delay < 0 || delay > UINT32_MAX) return -2;
+
+    samples[samples_next] = (struct sample){
+        .local = t4,
+        .offset = ((int64_t)(t2 - t1) + (int64_t)(t3 - t4)) / 2,
+        .delay = delay,
+    };
+    samples_next = (samples_next + 1) % TIMESYNC_SAMPLES;
+    if(samples_count < TIMESYNC_SAMPLES) ++samples_count;
+    LOGV("Offset %d us, round trip %d us", (int)samples[(samples_next + TIMESYNC_SAMPLES - 1) % TIMESYNC_SAMPLES].offset, (int)delay);
+
+    // the shortest round trip is the least skewed by queues
+    best = samples;
+    for(int i=1;i<samples_count;++i) {
+        if(samples[i].delay < best->delay) best = &samples[i];
+    }
+    if(best->local != used_local) use_sample(best);
+    return 0;
+}
+
+int timesync_command(uint8_t *buf, size_t len, uint32_t arrival_us) {
+    uint8_t reply[25];
+    int ret = 0;
+
+    if(len < 1) return -1;
+    switch(buf[0]) {
+    case TIMESYNC_REQUEST:
+        if(len < 9) return -1;
+        reply[0] = TIMESYNC_REPLY;
+        memcpy(reply + 1, buf + 1, 8);
+        // T2 when the request came in, T3 as the answer goes out, the time between is not on the network
+        put_be64(reply + 9, timesync_now_us() - (uint32_t)(sdk_system_get_time() - arrival_us));
+        put_be64(reply + 17, timesync_now_us());
+        return art_net_reply(ART_NET_TIME_SYNC, reply, sizeof(reply)) == 0 ? 0 : -2;
+    case TIMESYNC_REPLY:
+        if(xSemaphoreTake(timesync_lock, 100) != pdTRUE) {
+            LOGE("FAILED TO TAKE LOCK");
+            return -3;
+        }
+        ret = handle_reply(buf + 1, len - 1, arrival_us);
+        xSemaphoreGive(timesync_lock);
+        return ret;
+    case TIMESYNC_MASTER:
+        if(len < 5) return -1;
+        memcpy(&config.time_master, buf + 1, 4);
+        config_save();
+        LOGI("Time master: %d.%d.%d.%d", buf[1], buf[2], buf[3], buf[4]);
+        return 0;
+    default:
+        LOGW("Unknown time sync command %d", buf[0]);
+        return -4;
+    }
+}
+
+static void timesync_task(void *pvParameters) {
+    uint8_t request[9];
+    uint32_t period;
+
+    while(1) {
+        period = TIMESYNC_PERIOD;
+        if(config.time_master) {
+            if(xSemaphoreTake(timesync_lock, 100) == pdTRUE) {
+                request_t1 = local_us();
+                if(samples_count < TIMESYNC_SAMPLES) period /= 4;
+                xSemaphoreGive(timesync_lock);
+            }else{
+                LOGE("FAILED TO TAKE LOCK");
+            }
+            request[0] = TIMESYNC_REQUEST;
+            put_be64(request + 1, request_t1);
+            art_net_send(config.time_master, ART_NET_TIME_SYNC, request, sizeof(request));
+        } else {
+            local_us(); // counts the clock wraps
+        }
+        vTaskDelay(period / portTICK_PERIOD_MS);
+    }
+    vTaskDelete(NULL);
+}
+
+void timesync_init() {
+    timesync_lock = xSemaphoreCreateMutex();
+    TaskHandle_t task = NULL;
+    xTaskCreate(timesync_task, TAG, 256, NULL, 2, &task);
+    monitor_register(task);
+}
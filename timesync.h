@@ -0,0 +1,52 @@
+/*
+ * timesync.h
+ *
+ * Clock shared by the nodes, for effects that have to stay in phase without streaming frames.
+ * A node with a master set (see README, 0xf82b) sends it NTP-style requests every TIMESYNC_PERIOD ms.
+ * Of the last TIMESYNC_SAMPLES answers the one with the shortest round trip sets the offset,
+ * offsets at least TIMESYNC_DRIFT_SPAN ms apart give the drift of the local clock.
+ * Every node answers requests with its shared clock, so masters can be chained.
+ */
+
+#ifndef TIMESYNC_H_
+#define TIMESYNC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifndef TIMESYNC_PERIOD
+#define TIMESYNC_PERIOD 2000 /* ms between requests, a quarter of it until the samples are full */
+#endif
+
+#ifndef TIMESYNC_SAMPLES
+#define TIMESYNC_SAMPLES 8
+#endif
+
+#ifndef TIMESYNC_DRIFT_SPAN
+#define TIMESYNC_DRIFT_SPAN 30000 /* ms */
+#endif
+
+#ifndef TIMESYNC_MAX_DRIFT
+#define TIMESYNC_MAX_DRIFT 500 /* ppm, larger estimates are clamped */
+#endif
+
+#ifndef TIMESYNC_STEP
+#define TIMESYNC_STEP 100 /* ms, a larger offset change is a new master clock and restarts the estimation */
+#endif
+
+void timesync_init();
+
+/**
+ * Shared clock in microseconds, the local clock until the first answer of the master.
+ */
+uint64_t timesync_now_us();
+
+/**
+ * Handles the payload of the time sync opcode: COMMAND + ARGUMENTS, arrival_us is
+ * the sdk_system_get_time of the packet reception.
+ * Returns 0 on success or negative error code.
+ */
+int timesync_command(uint8_t *buf, size_t len, uint32_t arrival_us);
+
+#endif /* TIMESYNC_H_ */
@@ -8,11 +8,18 @@
 
 #include "FreeRTOS.h"
 #include "semphr.h"
+#include "event_groups.h"
 #include "dhcpserver.h"
+#include "lwip/netif.h"
+#include "lwip/tcpip.h"
 
 #include "logger.h"
 #include "wifi.h"
+#include "wifi_settings.h"
+#include "wifi_fsm.h"
+#include "monitor.h"
 #include "sysparam_macros.h"
+#include "config.h"
 #include "ssid_config.h"
 
 
@@ -23,9 +30,13 @@ static ip_addr_t ap_ip_mask;
 
 static struct station_settings_t *sta_settings;
 static SemaphoreHandle_t wifi_station_settings_manipulation_lock;
-static int current_station_index=0;
-static uint8_t trials_count=0, connection_status=STATION_IDLE;
-static bool stated_got_ip = false;
+static EventGroupHandle_t wifi_event_group;
+static struct wifi_fsm fsm;
+static uint8_t connection_status=STATION_IDLE;
+
+#define SETTINGS_CHANGED_BIT BIT0
+#define SCAN_DONE_BIT BIT1
+#define NETIF_STATUS_BIT BIT2
 
 static char *wifi_ap_ssid = NULL;
 static char *wifi_ap_pass = NULL;
@@ -61,14 +72,14 @@ char *base_ap_ssid(){
 }
 
 
-#define SPTW_GET(type, what, where) SPTW_GETR(type, what, where, vTaskDelete(NULL);\
-        return)
-#define SPTW_SET(type, what, where) SPTW_SETR(type, what, where, vTaskDelete(NULL);\
-        return)
-#define SPTW_GETN(type, what) SPTW_GET(type, what, what)
-#define SPTW_SETN(type, what) SPTW_SET(type, what, what)
-#define SPTW_GETNN(type, what) SPTW_GETR(type, what, what, return NULL)
-#define SPTW_SETNN(type, what) SPTW_SETR(type, what, what, return NULL)
+static void save_ap_config() {
+    strncpy(config.wifi_ap_ssid, wifi_ap_ssid, CONFIG_AP_SSID_LEN-1);
+    config.wifi_ap_ssid[CONFIG_AP_SSID_LEN-1] = 0;
+    strncpy(config.wifi_ap_pass, wifi_ap_pass, CONFIG_AP_PASS_LEN-1);
+    config.wifi_ap_pass[CONFIG_AP_PASS_LEN-1] = 0;
+    config.wifi_ap_always = wifi_ap_always;
+    config_save();
+}
 
 void set_mode_bit(uint8_t mode_bits) {
     uint8_t opmode = sdk_wifi_get_opmode();
@@ -156,7 +167,11 @@ void set_ap(char*ssid, char*pass, bool must_set) {
     dhcpserver_start(&first_dhcp_ip, AP_MAX_DHCP);
 }
 
-void set_sta(char*ssid, char*pass, bool must_set) {
+/**
+ * Connects to the station, directly to the cached BSSID on its channel if there is one.
+ */
+void set_sta(struct station_settings_t *station, bool must_set) {
+    char *ssid = station->ssid, *pass = station->pass;
     if(!ssid || ssid[0] == 0) {
         LOGI("WiFi station disabling");
         unset_mode_bit(STATION_MODE);
@@ -171,7 +186,15 @@ void set_sta(char*ssid, char*pass, bool must_set) {
         strncpy((char*)sta_config.ssid, ssid, sizeof(sta_config.ssid)-1);
         sta_config.ssid[sizeof(sta_config.ssid)-1] = 0;
     }
-    SET_TEST(sta_config.bssid_set, 0, need_setup);
+    if(station->channel) {
+        SET_TEST(sta_config.bssid_set, 1, need_setup);
+        if(memcmp(sta_config.bssid, station->bssid, WIFI_BSSID_LEN)) {
+            need_setup = true;
+            memcpy(sta_config.bssid, station->bssid, WIFI_BSSID_LEN);
+        }
+    } else {
+        SET_TEST(sta_config.bssid_set, 0, need_setup);
+    }
     if(!pass) pass="";
 
     if(strcmp(pass, (char*)sta_config.password)){
@@ -184,21 +207,216 @@ void set_sta(char*ssid, char*pass, bool must_set) {
     if(!(opmode & STATION_MODE)) need_setup = true;
 
     if(!need_setup && !must_set) return;
-    LOGI("WiFi station connecting to %s", ssid);
+    IFLOGI(if(station->channel) LOGI("WiFi station connecting to %s at %02x:%02x:%02x:%02x:%02x:%02x channel %d", ssid,
+            station->bssid[0], station->bssid[1], station->bssid[2],
+            station->bssid[3], station->bssid[4], station->bssid[5], station->channel);
+        else LOGI("WiFi station connecting to %s", ssid);)
 
     if(opmode & STATION_MODE) sdk_wifi_station_disconnect();
     else set_mode_bit(STATION_MODE);
+    if(station->channel) sdk_wifi_set_channel(station->channel);
 
     sdk_wifi_station_set_config(&sta_config);
     sdk_wifi_station_connect();
 }
 
-struct station_settings_t {
-    uint8_t trials_count;
-    char* ssid;
-    char* pass;
-};
 static const char *wifi_sta_settings_name="wifi_sta_settings";
+static const char *wifi_sta_cache_name="wifi_sta_cache";
+
+static void load_wifi_station_cache(struct station_settings_t *settings) {
+    int err;
+    uint8_t *buf = NULL;
+    size_t len = 0;
+    bool is_binary;
+    if((err=sysparam_get_data(wifi_sta_cache_name, &buf, &len, &is_binary)) < SYSPARAM_OK) {
+        LOGE("sysparam_get_data %s failed (%d)", wifi_sta_cache_name, err);
+        return;
+    }
+    if(buf) {
+        apply_wifi_station_cache(settings, buf, len);
+        free(buf);
+    }
+}
+
+static void save_wifi_station_cache(struct station_settings_t *settings) {
+    int err;
+    size_t len;
+    uint8_t *buf = pack_wifi_station_cache(settings, &len);
+    if((err=sysparam_set_data(wifi_sta_cache_name, buf ? buf : (uint8_t*)"", len, true)) != SYSPARAM_OK) {
+        LOGE("sysparam_set_data %s failed (%d)", wifi_sta_cache_name, err);
+    }
+    free(buf);
+}
+
+static bool cache_dirty = false; // station BSSIDs differ from the saved cache
+static int8_t scan_rssi[WIFI_FSM_MAX_STATIONS];
+
+#define SCAN_MAX_APS 16 // strongest APs kept of a scan
+
+struct scan_ap {
+    uint8_t ssid[32];
+    uint8_t bssid[WIFI_BSSID_LEN];
+    uint8_t channel;
+    int8_t rssi;
+};
+
+// scan result handed from the SDK context to wifi_daemon_task, written only while scan_ready is false
+static struct scan_ap scan_aps[SCAN_MAX_APS];
+static int scan_aps_count = 0;
+static volatile bool scan_ready = false;
+
+/**
+ * Copies the APs found into scan_aps, runs in the SDK context so it must not block.
+ * The stations are ranked by wifi_daemon_task, see rank_scan.
+ */
+static void scan_done_cb(struct sdk_bss_info *bss, sdk_scan_status_t status) {
+    int count = 0, weakest;
+    if(scan_ready) {
+        LOGW("Previous scan not taken yet, dropping this one");
+        return;
+    }
+    for(;status == SCAN_OK && bss;bss = STAILQ_NEXT(bss, next)) {
+        if(count < SCAN_MAX_APS) {
+            weakest = count++;
+        } else {
+            // full, replace the weakest AP if this one is stronger
+            weakest = 0;
+            for(int i=1;i<SCAN_MAX_APS;++i) {
+                if(scan_aps[i].rssi < scan_aps[weakest].rssi) weakest = i;
+            }
+            if(bss->rssi <= scan_aps[weakest].rssi) continue;
+        }
+        memcpy(scan_aps[weakest].ssid, bss->ssid, sizeof(scan_aps[weakest].ssid));
+        memcpy(scan_aps[weakest].bssid, bss->bssid, WIFI_BSSID_LEN);
+        scan_aps[weakest].channel = bss->channel;
+        scan_aps[weakest].rssi = bss->rssi;
+    }
+    scan_aps_count = count;
+    scan_ready = true;
+    xEventGroupSetBits(wifi_event_group, SCAN_DONE_BIT);
+}
+
+/**
+ * Ranks the stations by the best RSSI of their SSID and caches the BSSID and channel of that AP.
+ * Must be called with wifi_station_settings_manipulation_lock taken.
+ */
+static void rank_scan() {
+    int i;
+    struct station_settings_t *station;
+    for(i=0;i<WIFI_FSM_MAX_STATIONS;++i) scan_rssi[i] = WIFI_FSM_NO_RSSI;
+    for(struct scan_ap *ap=scan_aps;ap<scan_aps+scan_aps_count;++ap) {
+        for(i=0, station=sta_settings;i<WIFI_FSM_MAX_STATIONS && station->ssid;++i, ++station) {
+            if(ap->rssi <= scan_rssi[i] || strncmp((char*)ap->ssid, station->ssid, sizeof(ap->ssid))) continue;
+            scan_rssi[i] = ap->rssi;
+            if(station->channel != ap->channel || memcmp(station->bssid, ap->bssid, WIFI_BSSID_LEN)) {
+                memcpy(station->bssid, ap->bssid, WIFI_BSSID_LEN);
+                station->channel = ap->channel;
+                cache_dirty = true;
+            }
+        }
+    }
+    scan_ready = false;
+}
+
+static void station_netif_status_cb(struct netif *netif) {
+    xEventGroupSetBits(wifi_event_group, NETIF_STATUS_BIT);
+}
+
+static void start_scan() {
+    set_mode_bit(STATION_MODE);
+    sdk_wifi_station_disconnect();
+    if(!sdk_wifi_station_scan(NULL, scan_done_cb)) {
+        LOGW("Scan failed to start"); // the scan times out
+    }
+}
+
+/**
+ * The first station with a cached BSSID, or -1.
+ */
+static int preferred_station() {
+    int i;
+    for(i=0;sta_settings[i].ssid;++i) {
+        if(sta_settings[i].channel) return i;
+    }
+    return -1;
+}
+
+static int station_count() {
+    int i;
+    for(i=0;sta_settings[i].ssid;++i) {}
+    return i;
+}
+
+/**
+ * Carries out WIFI_ACT_* of fsm, must be called with wifi_station_settings_manipulation_lock taken.
+ */
+static void run_actions(int actions) {
+    if(actions & WIFI_ACT_AP_ON) {
+        set_ap(wifi_ap_ssid, wifi_ap_pass, false);
+    }
+    if(actions & WIFI_ACT_SCAN) {
+        start_scan();
+    }
+    if(actions & WIFI_ACT_CONNECT) {
+        set_sta(&sta_settings[fsm.station], true);
+#if LWIP_NETIF_STATUS_CALLBACK
+        // the station netif exists once the station mode is on
+        struct netif *netif;
+        if((netif = sdk_system_get_netif(STATION_IF))) {
+            LOCK_TCPIP_CORE();
+            netif_set_status_callback(netif, station_netif_status_cb);
+            UNLOCK_TCPIP_CORE();
+        }
+#endif
+    }
+    if(actions & WIFI_ACT_AP_OFF) {
+        LOGI("WiFi station %s connected", sta_settings[fsm.station].ssid);
+        if(!wifi_ap_always) {
+            set_ap(NULL, NULL, false);
+        }
+        if(cache_dirty) {
+            save_wifi_station_cache(sta_settings);
+            cache_dirty = false;
+        }
+    }
+}
+
+/**
+ * Starts fsm over with the station list, must be called with wifi_station_settings_manipulation_lock taken
+ * in the same hold that sets sta_settings, so no index of the previous list is used with the new one.
+ */
+static void restart_stations() {
+    connection_status = STATION_IDLE;
+    run_actions(wifi_fsm_start(&fsm, station_count(), preferred_station(), xTaskGetTickCount() * portTICK_PERIOD_MS));
+}
+
+/**
+ * Feeds the station status to fsm, must be called with wifi_station_settings_manipulation_lock taken.
+ */
+static int check_station(uint32_t now) {
+    struct station_settings_t *station = &sta_settings[fsm.station];
+    connection_status = sdk_wifi_station_get_connect_status();
+    switch(connection_status) {
+    case STATION_GOT_IP:
+        return wifi_fsm_got_ip(&fsm, now);
+    case STATION_CONNECT_FAIL:
+    case STATION_WRONG_PASSWORD:
+    case STATION_NO_AP_FOUND:
+        LOGI("WiFi station %s status: %s", station->ssid,
+                connection_status==STATION_NO_AP_FOUND ? "not found" :
+                        connection_status==STATION_WRONG_PASSWORD ? "wrong password" :
+                                "failure");
+        if(fsm.direct) {
+            // the AP may have moved, the scan finds it again
+            station->channel = 0;
+            cache_dirty = true;
+        }
+        return wifi_fsm_fail(&fsm, now);
+    default:
+        // idle or connecting, a connected station is lost
+        return fsm.state == WIFI_FSM_CONNECTED ? wifi_fsm_fail(&fsm, now) : 0;
+    }
+}
 
 int save_wifi_station_settings(struct station_settings_t *settings) {
     int i, err=SYSPARAM_OK;
@@ -227,73 +445,18 @@ int save_wifi_station_settings(struct station_settings_t *settings) {
     return err;
 }
 
-void free_wifi_station_settings(struct station_settings_t *settings) {
-    int i;
-    for(i=0;settings[i].ssid;++i) {
-        free(settings[i].ssid);
-        free(settings[i].pass);
-    }
-    free(settings);
-}
-
-struct station_settings_t * parse_binary_wifi_station_settings(char*wifi_sta_settings_bin,
-        size_t wifi_sta_settings_length) {
-
-    struct station_settings_t *ret=NULL;
-    size_t len, i;
-    char*p,*begin;
-
-    if(wifi_sta_settings_bin) {
-        i=0;
-        for(p=wifi_sta_settings_bin;p-wifi_sta_settings_bin<wifi_sta_settings_length && *p;++p) {
-            for(begin=p;p-wifi_sta_settings_bin<wifi_sta_settings_length && *p;++p) {};// ssid
-            IFLOGV(if(p-wifi_sta_settings_bin<wifi_sta_settings_length)LOGV("--%d ssid: %s", i,begin);)
-            for(++p,begin=p;p-wifi_sta_settings_bin<wifi_sta_settings_length && *p;++p) {};// pass
-            IFLOGV(if(p-wifi_sta_settings_bin<wifi_sta_settings_length)LOGV("--%d pass: %s", i,begin);)
-            if(p-wifi_sta_settings_bin<wifi_sta_settings_length && !(*p)) ++i;
-        }
-        LOGV("Found %d stations", i);
-        if(i > 0) {
-            len = i;
-            ret = (struct station_settings_t *)malloc(sizeof(struct station_settings_t)*(len+1));
-            i=0;
-            for(p=wifi_sta_settings_bin;p-wifi_sta_settings_bin<wifi_sta_settings_length && *p;++p) {
-                begin=p;
-                for(;p-wifi_sta_settings_bin<wifi_sta_settings_length && *p;++p) {};// ssid
-                ret[i].ssid = strdup(begin);
-
-                begin=++p;
-                for(;p-wifi_sta_settings_bin<wifi_sta_settings_length && *p;++p) {};// pass
-                ret[i].pass = strdup(begin);
-
-                ret[i].trials_count = 0;
-
-                ++i;
-                if(i>=len) break;
-            }
-            ret[len].ssid = NULL;
-            ret[len].pass = NULL;
-            ret[len].trials_count = 0;
-        }
-    }
-
-    return ret;
-}
-
 int update_wifi_station_settings(char* buf, size_t len){
     LOGV("Update wifi_sta_settings, len: %d", len);
     struct station_settings_t *new_settings = parse_binary_wifi_station_settings(buf, len), *old_settings=NULL;
     if(new_settings) {
         if(xSemaphoreTake(wifi_station_settings_manipulation_lock, 1000) == pdTRUE) {
             LOGV("Switching to new wifi_sta_settings");
+            load_wifi_station_cache(new_settings);
             old_settings=sta_settings;
             sta_settings=new_settings;
-            current_station_index=0;
-            trials_count=0;
-            stated_got_ip = false;
-
-            set_sta(sta_settings[current_station_index].ssid, sta_settings[current_station_index].pass, false);
+            restart_stations();
             save_wifi_station_settings(new_settings);
+            xEventGroupSetBits(wifi_event_group, SETTINGS_CHANGED_BIT);
             xSemaphoreGive(wifi_station_settings_manipulation_lock);
         }else{
             LOGE("FAILED TO TAKE LOCK");
@@ -320,7 +483,6 @@ int update_wifi_station_settings(char* buf, size_t len){
 
 int update_wifi_ap_settings(char* buf, size_t len){
     LOGV("Update wifi_ap_settings, len: %d", len);
-    int err;
     char *p, *begin_ap_pass, *begin_ap_ssid = buf+1;
     if(len<3) {
         LOGE("Wrong buffer (too small)");
@@ -352,11 +514,8 @@ int update_wifi_ap_settings(char* buf, size_t len){
         LOGD("Filled AP SSID: %s", wifi_ap_ssid);
         old_pass = wifi_ap_pass;
         wifi_ap_pass = strdup(begin_ap_pass);
-        SPTW_SETR(string, wifi_ap_ssid, wifi_ap_ssid, return -3);
-        SPTW_SETR(string, wifi_ap_pass, wifi_ap_pass, return -3);
-
         wifi_ap_always = new_ap_always;
-        SPTW_SETR(int8, wifi_ap_always, wifi_ap_always, return -3);
+        save_ap_config();
 
         LOGI("New WiFi AP SSID: %s, pass: %s, always: %d", wifi_ap_ssid, wifi_ap_pass, wifi_ap_always);
         if(wifi_ap_always || connection_status != STATION_GOT_IP) {
@@ -399,18 +558,17 @@ struct station_settings_t * get_wifi_station_settings() {
     if(!ret) {
         len = 1;
         i=0;
-        ret = (struct station_settings_t *)malloc(sizeof(struct station_settings_t)*(len+1));
+        ret = (struct station_settings_t *)calloc(len+1, sizeof(struct station_settings_t));
 
         ret[i].ssid = strdup(WIFI_SSID);
         ret[i].pass = strdup(WIFI_PASS);
-        ret[i].trials_count = 0;
         if(++i==len) goto end_of_settings; // here goto prevents accidental buffer overflow
 
 end_of_settings:
         ret[i].ssid = NULL;
         ret[i].pass = NULL;
-        ret[i].trials_count = 0;
     }
+    load_wifi_station_cache(ret);
     IFLOGI(
             LOGI("WiFi stations:");
             struct station_settings_t *I=NULL;
@@ -426,25 +584,21 @@ end_of_settings:
 static void wifi_daemon_task(void *pvParameters)
 {
     LOGI("Started task");
-    int err;
 
     ipaddr_aton(AP_IP_SELf, &ap_ip_self);
     ipaddr_aton(AP_IP_MASK, &ap_ip_mask);
 
     if(xSemaphoreTake(wifi_station_settings_manipulation_lock, 1000) == pdTRUE) {
-        SPTW_GETN(string, wifi_ap_ssid);
-        if (!wifi_ap_ssid) {
-            wifi_ap_ssid = base_ap_ssid();
-            SPTW_SETN(string, wifi_ap_ssid);
-        }
-        SPTW_GETN(string, wifi_ap_pass);
-        if (!wifi_ap_pass) {
-            wifi_ap_pass = strdup(AP_BASE_PASS);
-            SPTW_SETN(string, wifi_ap_pass);
+        wifi_ap_always = config.wifi_ap_always;
+        if(config.wifi_ap_ssid[0] && config.wifi_ap_pass[0]) {
+            wifi_ap_ssid = strdup(config.wifi_ap_ssid);
+            wifi_ap_pass = strdup(config.wifi_ap_pass);
+        } else {
+            wifi_ap_ssid = strdup(config.wifi_ap_ssid[0] ? config.wifi_ap_ssid : base_ap_ssid());
+            wifi_ap_pass = strdup(config.wifi_ap_pass[0] ? config.wifi_ap_pass : AP_BASE_PASS);
+            save_ap_config();
         }
         LOGV("Got wifi_ap ssid: %s, pass: %s", wifi_ap_ssid, wifi_ap_pass);
-
-        SPTW_GETN(int8, wifi_ap_always);
         LOGV("Got wifi_ap_always: %d", wifi_ap_always);
         if(wifi_ap_always) {
             set_ap(wifi_ap_ssid, wifi_ap_pass, true);
@@ -464,68 +618,49 @@ static void wifi_daemon_task(void *pvParameters)
             vTaskDelete(0);
             return;
         }
+        restart_stations();
         xSemaphoreGive(wifi_station_settings_manipulation_lock);
     }else{
         LOGE("FAILED TO TAKE LOCK");
         vTaskDelete(0);
         return;
     }
-    set_sta(sta_settings[current_station_index].ssid, sta_settings[current_station_index].pass, true);
 
     while (1) {
+        int32_t wait = wifi_fsm_wait(&fsm, xTaskGetTickCount() * portTICK_PERIOD_MS);
+        if(fsm.state == WIFI_FSM_CONNECTING && (wait < 0 || wait > STA_CONNECT_POLL)) wait = STA_CONNECT_POLL;
+        if(fsm.state == WIFI_FSM_CONNECTED) wait = STA_IDLE_TIMER;
+        EventBits_t bits = xEventGroupWaitBits(wifi_event_group,
+                SETTINGS_CHANGED_BIT | SCAN_DONE_BIT | NETIF_STATUS_BIT, pdTRUE, pdFALSE,
+                wait < 0 ? portMAX_DELAY : wait / portTICK_PERIOD_MS);
+
         if(xSemaphoreTake(wifi_station_settings_manipulation_lock, 1000) == pdTRUE) {
-            if(sta_settings[current_station_index].ssid){
-                connection_status = sdk_wifi_station_get_connect_status();
-
-                switch(connection_status) {
-                case STATION_IDLE:
-                    set_sta(sta_settings[current_station_index].ssid, sta_settings[current_station_index].pass, true);
-                    break;
-                case STATION_CONNECTING:
-                    // noop
-                    break;
-                case STATION_CONNECT_FAIL:
-                case STATION_WRONG_PASSWORD:
-                case STATION_NO_AP_FOUND:
-                    LOGI("WiFi station %s status: %s", sta_settings[current_station_index].ssid,
-                            connection_status==STATION_NO_AP_FOUND ? "not found" :
-                                    connection_status==STATION_WRONG_PASSWORD ? "wrong password" :
-                                            "failure");
-                    ++current_station_index;
-                    if(!sta_settings[current_station_index].ssid){
-                        current_station_index=0;
-                        if(trials_count < STA_TRIALS_BEFORE_AP) ++trials_count;
-                        else {
-                            set_ap(wifi_ap_ssid, wifi_ap_pass, false);
-                        }
-                    }
-                    set_sta(sta_settings[current_station_index].ssid, sta_settings[current_station_index].pass, false);
-                    break;
-                case STATION_GOT_IP:
-                    if(!stated_got_ip) {
-                        LOGI("WiFi station %s connected", sta_settings[current_station_index].ssid);
-                        trials_count = 0;
-
-                        if(!wifi_ap_always) {
-                            set_ap(NULL, NULL, false);
-                        }
-                    }
-                    break;
-                default:
-                    LOGE("NOT IMPLEMENTED: connection status %d", connection_status);
-                }
-                stated_got_ip = (connection_status == STATION_GOT_IP);
+            uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+            // new settings restarted fsm already, the bit only wakes the task up for its new deadline
+            // and keeps the status of the previous station from being taken for the new one,
+            // it is read again as the settings may have changed while the lock was awaited
+            bits |= xEventGroupClearBits(wifi_event_group, SETTINGS_CHANGED_BIT);
+            if(!(bits & SETTINGS_CHANGED_BIT)
+                    && (fsm.state == WIFI_FSM_CONNECTING || fsm.state == WIFI_FSM_CONNECTED)) {
+                run_actions(check_station(now));
+            }
+            if(scan_ready) {
+                rank_scan();
+                run_actions(wifi_fsm_scan_done(&fsm, scan_rssi, now));
             }
+            run_actions(wifi_fsm_poll(&fsm, now));
             xSemaphoreGive(wifi_station_settings_manipulation_lock);
         }else{
             LOGE("FAILED TO TAKE LOCK");
         }
-        vTaskDelay(STA_IDLE_TIMER / portTICK_PERIOD_MS); // throttle
     }
     vTaskDelete(NULL);
 }
 
 void wifi_init() {
     wifi_station_settings_manipulation_lock = xSemaphoreCreateMutex();
-    xTaskCreate(wifi_daemon_task, TAG, 512, NULL, 1, NULL);
+    wifi_event_group = xEventGroupCreate();
+    TaskHandle_t task = NULL;
+    xTaskCreate(wifi_daemon_task, TAG, 512, NULL, 1, &task);
+    monitor_register(task);
 }
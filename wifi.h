@@ -38,7 +38,16 @@
 #endif
 
 #ifndef STA_IDLE_TIMER
-#define STA_IDLE_TIMER 1000 /* every 1 seconds */
+#define STA_IDLE_TIMER 1000 /* pause before a new scan after all the stations failed, link check when connected */
+#endif
+#ifndef STA_CONNECT_TIMEOUT
+#define STA_CONNECT_TIMEOUT 10000 /* give up a station that neither connects nor fails */
+#endif
+#ifndef STA_CONNECT_POLL
+#define STA_CONNECT_POLL 100 /* the SDK reports connection failures only by status, checked this often while connecting */
+#endif
+#ifndef STA_SCAN_TIMEOUT
+#define STA_SCAN_TIMEOUT 5000
 #endif
 #ifndef STA_TRIALS_BEFORE_AP
 #define STA_TRIALS_BEFORE_AP 3 /* after 3 trials on each of the networks, the AP will be created */
@@ -0,0 +1,137 @@
+/*
+ * wifi_fsm.c
+ *
+ * Station selection state machine, see wifi_fsm.h
+ */
+#include <stddef.h>
+
+#include "wifi_fsm.h"
+#include "wifi.h"
+#include "logger.h"
+
+static const char *TAG = "wifi_fsm";
+
+static void set_deadline(struct wifi_fsm *fsm, uint32_t now, uint32_t ms) {
+    fsm->deadline = now + ms;
+    fsm->timed = true;
+}
+
+static int scan(struct wifi_fsm *fsm, uint32_t now) {
+    LOGD("Scanning");
+    fsm->state = WIFI_FSM_SCANNING;
+    fsm->direct = false;
+    set_deadline(fsm, now, STA_SCAN_TIMEOUT);
+    return WIFI_ACT_SCAN;
+}
+
+static int connect_station(struct wifi_fsm *fsm, int station, uint32_t now) {
+    fsm->state = WIFI_FSM_CONNECTING;
+    fsm->station = station;
+    set_deadline(fsm, now, STA_CONNECT_TIMEOUT);
+    return WIFI_ACT_CONNECT;
+}
+
+static int connect_next(struct wifi_fsm *fsm, uint32_t now) {
+    if(fsm->next < fsm->ranked) {
+        return connect_station(fsm, fsm->order[fsm->next++], now);
+    }
+    if(fsm->rounds < UINT8_MAX) ++fsm->rounds;
+    LOGI("All %d stations failed, round %d", fsm->count, fsm->rounds);
+    fsm->state = WIFI_FSM_IDLE;
+    fsm->station = -1;
+    set_deadline(fsm, now, STA_IDLE_TIMER);
+    return fsm->rounds >= STA_TRIALS_BEFORE_AP ? WIFI_ACT_AP_ON : 0;
+}
+
+int wifi_fsm_start(struct wifi_fsm *fsm, int count, int preferred, uint32_t now) {
+    if(count > WIFI_FSM_MAX_STATIONS) {
+        LOGW("Only %d of %d stations are used", WIFI_FSM_MAX_STATIONS, count);
+        count = WIFI_FSM_MAX_STATIONS;
+    }
+    fsm->count = count;
+    fsm->ranked = 0;
+    fsm->next = 0;
+    fsm->rounds = 0;
+    fsm->station = -1;
+    fsm->direct = false;
+    if(count <= 0) {
+        fsm->state = WIFI_FSM_IDLE;
+        fsm->timed = false;
+        return WIFI_ACT_AP_ON;
+    }
+    if(preferred >= 0 && preferred < count) {
+        LOGD("Connecting directly to station %d", preferred);
+        fsm->direct = true;
+        return connect_station(fsm, preferred, now);
+    }
+    return scan(fsm, now);
+}
+
+int wifi_fsm_scan_done(struct wifi_fsm *fsm, const int8_t *rssi, uint32_t now) {
+    int i, j;
+    if(fsm->state != WIFI_FSM_SCANNING) return 0;
+
+    // insertion sort keeps the configured order among equal RSSI, unseen stations go last
+    for(i=0;i<fsm->count;++i) {
+        for(j=i;j>0 && rssi[fsm->order[j-1]] < rssi[i];--j) {
+            fsm->order[j] = fsm->order[j-1];
+        }
+        fsm->order[j] = i;
+    }
+    fsm->ranked = fsm->count;
+    fsm->next = 0;
+    IFLOGD(for(i=0;i<fsm->ranked;++i) LOGD("-%2d. station %d, RSSI: %d", i, fsm->order[i], rssi[fsm->order[i]]);)
+    return connect_next(fsm, now);
+}
+
+int wifi_fsm_got_ip(struct wifi_fsm *fsm, uint32_t now) {
+    if(fsm->state == WIFI_FSM_CONNECTED) return 0;
+    fsm->state = WIFI_FSM_CONNECTED;
+    fsm->direct = false;
+    fsm->timed = false;
+    fsm->rounds = 0;
+    return WIFI_ACT_AP_OFF;
+}
+
+int wifi_fsm_fail(struct wifi_fsm *fsm, uint32_t now) {
+    switch(fsm->state) {
+    case WIFI_FSM_CONNECTING:
+        if(fsm->direct) {
+            LOGD("Direct connection to station %d failed", fsm->station);
+            return scan(fsm, now);
+        }
+        return connect_next(fsm, now);
+    case WIFI_FSM_CONNECTED:
+        LOGI("Station %d lost", fsm->station);
+        return scan(fsm, now);
+    default:
+        return 0;
+    }
+}
+
+int wifi_fsm_poll(struct wifi_fsm *fsm, uint32_t now) {
+    static const int8_t unseen[WIFI_FSM_MAX_STATIONS] = {
+        [0 ... WIFI_FSM_MAX_STATIONS-1] = WIFI_FSM_NO_RSSI
+    };
+    if(!fsm->timed || (int32_t)(fsm->deadline - now) > 0) return 0;
+    fsm->timed = false;
+    switch(fsm->state) {
+    case WIFI_FSM_SCANNING:
+        LOGW("Scan timed out");
+        return wifi_fsm_scan_done(fsm, unseen, now);
+    case WIFI_FSM_CONNECTING:
+        LOGI("Station %d timed out", fsm->station);
+        return wifi_fsm_fail(fsm, now);
+    case WIFI_FSM_IDLE:
+        return scan(fsm, now);
+    default:
+        return 0;
+    }
+}
+
+int32_t wifi_fsm_wait(const struct wifi_fsm *fsm, uint32_t now) {
+    int32_t left;
+    if(!fsm->timed) return -1;
+    left = fsm->deadline - now;
+    return left > 0 ? left : 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * wifi_fsm.h
+ *
+ * Station selection state machine driven by wifi_daemon_task.
+ * It makes no SDK calls: events are fed with the current time in ms and
+ * the returned WIFI_ACT_* bits are carried out by the caller, so it runs in the host build too.
+ *
+ * On start the station with a cached BSSID is connected directly, otherwise (and if that fails)
+ * one scan ranks the stations by RSSI and they are tried best-first.
+ * Stations not found by the scan (e.g. hidden ones) are tried last, in the configured order.
+ */
+
+#ifndef WIFI_FSM_H_
+#define WIFI_FSM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef WIFI_FSM_MAX_STATIONS
+#define WIFI_FSM_MAX_STATIONS 8
+#endif
+
+#define WIFI_FSM_NO_RSSI INT8_MIN // the station wasn't found by the scan
+
+enum {
+    WIFI_FSM_IDLE = 0,      // no stations or waiting STA_IDLE_TIMER after all of them failed
+    WIFI_FSM_SCANNING,
+    WIFI_FSM_CONNECTING,
+    WIFI_FSM_CONNECTED,
+};
+
+#define WIFI_ACT_SCAN       0x01
+#define WIFI_ACT_CONNECT    0x02 // to fsm->station
+#define WIFI_ACT_AP_ON      0x04
+#define WIFI_ACT_AP_OFF     0x08
+
+struct wifi_fsm {
+    uint8_t state;
+    uint8_t count;          // stations configured
+    uint8_t ranked;         // stations in order
+    uint8_t next;           // position in order to try next
+    uint8_t rounds;         // failed rounds since the last connection
+    bool direct;            // connecting to the cached BSSID without a scan
+    bool timed;             // deadline is valid
+    int8_t station;         // being connected or connected, -1 if none
+    uint32_t deadline;      // ms
+    uint8_t order[WIFI_FSM_MAX_STATIONS];
+};
+
+/**
+ * (Re)starts the selection from scratch, preferred is a station with a cached BSSID or -1.
+ */
+int wifi_fsm_start(struct wifi_fsm *fsm, int count, int preferred, uint32_t now);
+
+/**
+ * Scan result: the best RSSI of each of the count stations or WIFI_FSM_NO_RSSI.
+ */
+int wifi_fsm_scan_done(struct wifi_fsm *fsm, const int8_t *rssi, uint32_t now);
+
+int wifi_fsm_got_ip(struct wifi_fsm *fsm, uint32_t now);
+
+/**
+ * Connection to the current station failed or was lost.
+ */
+int wifi_fsm_fail(struct wifi_fsm *fsm, uint32_t now);
+
+/**
+ * Handles the deadline if it has passed.
+ */
+int wifi_fsm_poll(struct wifi_fsm *fsm, uint32_t now);
+
+/**
+ * Milliseconds until the deadline, -1 if there is none.
+ */
+int32_t wifi_fsm_wait(const struct wifi_fsm *fsm, uint32_t now);
+
+#endif /* WIFI_FSM_H_ */
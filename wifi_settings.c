@@ -0,0 +1,104 @@
+/*
+ * wifi_settings.c
+ *
+ * Station list parsing, kept apart from the SDK dependent wifi.c
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "wifi_settings.h"
+#include "logger.h"
+
+IFLOGV(static const char *TAG = "wifi_settings";) // only verbose logs here
+
+void free_wifi_station_settings(struct station_settings_t *settings) {
+    int i;
+    for(i=0;settings[i].ssid;++i) {
+        free(settings[i].ssid);
+        free(settings[i].pass);
+    }
+    free(settings);
+}
+
+struct station_settings_t * parse_binary_wifi_station_settings(char*wifi_sta_settings_bin,
+        size_t wifi_sta_settings_length) {
+
+    struct station_settings_t *ret=NULL;
+    size_t len, i;
+    char*p,*begin;
+
+    if(wifi_sta_settings_bin) {
+        i=0;
+        for(p=wifi_sta_settings_bin;p-wifi_sta_settings_bin<wifi_sta_settings_length && *p;++p) {
+            for(begin=p;p-wifi_sta_settings_bin<wifi_sta_settings_length && *p;++p) {};// ssid
+            IFLOGV(if(p-wifi_sta_settings_bin<wifi_sta_settings_length)LOGV("--%d ssid: %s", i,begin);)
+            for(++p,begin=p;p-wifi_sta_settings_bin<wifi_sta_settings_length && *p;++p) {};// pass
+            IFLOGV(if(p-wifi_sta_settings_bin<wifi_sta_settings_length)LOGV("--%d pass: %s", i,begin);)
+            if(p-wifi_sta_settings_bin<wifi_sta_settings_length && !(*p)) ++i;
+        }
+        LOGV("Found %d stations", i);
+        if(i > 0) {
+            len = i;
+            ret = (struct station_settings_t *)calloc(len+1, sizeof(struct station_settings_t));
+            i=0;
+            for(p=wifi_sta_settings_bin;p-wifi_sta_settings_bin<wifi_sta_settings_length && *p;++p) {
+                begin=p;
+                for(;p-wifi_sta_settings_bin<wifi_sta_settings_length && *p;++p) {};// ssid
+                ret[i].ssid = strdup(begin);
+
+                begin=++p;
+                for(;p-wifi_sta_settings_bin<wifi_sta_settings_length && *p;++p) {};// pass
+                ret[i].pass = strdup(begin);
+
+                ++i;
+                if(i>=len) break;
+            }
+            ret[len].ssid = NULL;
+            ret[len].pass = NULL;
+        }
+    }
+
+    return ret;
+}
+
+#define CACHE_ENTRY_TAIL (WIFI_BSSID_LEN + 1)
+
+uint8_t * pack_wifi_station_cache(const struct station_settings_t *settings, size_t *len) {
+    size_t size = 0;
+    uint8_t *buf, *p;
+    int i;
+
+    for(i=0;settings[i].ssid;++i) {
+        if(settings[i].channel) size += strlen(settings[i].ssid) + 1 + CACHE_ENTRY_TAIL;
+    }
+    *len = size;
+    if(!size) return NULL;
+    p = buf = malloc(size);
+    for(i=0;settings[i].ssid;++i) {
+        if(!settings[i].channel) continue;
+        strcpy((char*)p, settings[i].ssid);
+        p += strlen(settings[i].ssid) + 1;
+        memcpy(p, settings[i].bssid, WIFI_BSSID_LEN);
+        p[WIFI_BSSID_LEN] = settings[i].channel;
+        p += CACHE_ENTRY_TAIL;
+    }
+    return buf;
+}
+
+void apply_wifi_station_cache(struct station_settings_t *settings, const uint8_t *buf, size_t len) {
+    const uint8_t *p = buf, *end = buf + len, *ssid;
+    while(p < end) {
+        ssid = p;
+        while(p < end && *p) ++p;
+        if(end - p < 1 + CACHE_ENTRY_TAIL) break; // truncated
+        ++p;
+        for(int i=0;settings[i].ssid;++i) {
+            if(strcmp(settings[i].ssid, (const char*)ssid)) continue;
+            memcpy(settings[i].bssid, p, WIFI_BSSID_LEN);
+            settings[i].channel = p[WIFI_BSSID_LEN];
+            IFLOGV(LOGV("Cached %s: %02x:%02x:%02x:%02x:%02x:%02x channel %d", settings[i].ssid,
+                    p[0], p[1], p[2], p[3], p[4], p[5], settings[i].channel);)
+        }
+        p += CACHE_ENTRY_TAIL;
+    }
+}
@@ -0,0 +1,41 @@
+/*
+ * wifi_settings.h
+ *
+ * Station list as stored in sysparam and sent by Art-Net: (SSID + \0 + PASS + \0)*
+ * BSSID and channel of the last successful connection are cached apart: (SSID + \0 + BSSID + CHANNEL)*
+ */
+
+#ifndef WIFI_SETTINGS_H_
+#define WIFI_SETTINGS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define WIFI_BSSID_LEN 6
+
+struct station_settings_t {
+    char* ssid;
+    char* pass;
+    uint8_t bssid[WIFI_BSSID_LEN];
+    uint8_t channel; // 0 if the BSSID is unknown
+};
+
+/**
+ * Returns a list terminated by an entry with NULL ssid, or NULL if there are no stations.
+ */
+struct station_settings_t * parse_binary_wifi_station_settings(char*wifi_sta_settings_bin,
+        size_t wifi_sta_settings_length);
+void free_wifi_station_settings(struct station_settings_t *settings);
+
+/**
+ * Packs the cached BSSIDs and channels into a malloc'd buffer, NULL if nothing is cached.
+ */
+uint8_t * pack_wifi_station_cache(const struct station_settings_t *settings, size_t *len);
+
+/**
+ * Fills BSSIDs and channels of the stations found in the packed cache by SSID.
+ */
+void apply_wifi_station_cache(struct station_settings_t *settings, const uint8_t *buf, size_t len);
+
+#endif /* WIFI_SETTINGS_H_ */
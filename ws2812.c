@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <math.h>
 
 #include <time.h>
@@ -16,15 +17,30 @@
 #include "logger.h"
 #include "sysparam.h"
 
-#include "sysparam_macros.h"
+#include "config.h"
 #include "color_conv.h"
+#include "pixel_vm.h"
+#include "cue.h"
+#include "compositor.h"
+#include "monitor.h"
+#include "timesync.h"
+#include "probe.h"
+#include "pixel_map.h"
+#include "swar.h"
 
 static const char* TAG = "ws2812";
 
 static EventGroupHandle_t ws2812_event_group;
 static SemaphoreHandle_t ws2812_pixels_manipulation_lock;
-static ws2812_pixel_t *pixels=NULL;
-static uint8_t program = 0;
+static ws2812_pixel_t *pixels=NULL; // rendered by the base layer program
+static ws2812_pixel_t *overlay=NULL; // live DMX layer
+static ws2812_pixel_t master_color = {.red = 255, .green = 255, .blue = 255};
+static ws2812_pixel_t *output=NULL; // composited, sent to the strip
+static ws2812_pixel_t *fade_from=NULL; // base layer look at the start of the cue crossfade
+static struct layer layers[LAYER_COUNT];
+static bool frame_dirty = true; // output differs from what the strip shows
+static TickType_t last_output = 0;
+static uint32_t last_output_us = 0;
 #define REFRESH_PIXELS_BIT BIT0
 
 struct program_rainbow {
@@ -32,317 +48,1008 @@ struct program_rainbow {
     uint16_t delay; // in ms
     uint16_t step_time; // 0-360
     uint16_t step_length; // 0-360
-    color_HSV current;
+    color_HSV begin; // at the shared clock 0
     ws2812_pixel_t tint; // pixel = tint*tint_level/255 + pixel_raw*(255-tiny_level)/255;
     uint8_t tint_level;
     uint8_t tint_type; // rgb (<128) or hsl (>=128)
 };
+struct program_shader {
+    uint8_t id; // unique id for this setting. If the same, don't restart the time
+    uint16_t delay; // in ms
+    uint32_t start; // ms of the shared clock
+};
 union program_settings_t {
     struct program_rainbow rainbow;
+    struct program_shader shader;
 };
-static union program_settings_t program_settings = {};
 
-void ws2812_update(uint8_t *rgbbytes, int len) {
-    LOGV("Starting ws2812_update, len %d", len);
-    if(len<1) {
-        LOGD("No bytes to process, skipping");
-        return;
-    }
-    uint8_t new_program = *rgbbytes;
+/* state of the program rendered into a layer or into a segment of the overlay */
+struct program {
+    union program_settings_t settings;
+    struct pixel_vm_state shader_state;
+    TickType_t effect_due; // next frame of an effect
+    uint16_t size; // pixels it renders
+};
+static struct program base_program = {.size = LED_NUMBER}; // base and overlay layer
 
-    ++rgbbytes;
-    --len;
-    LOGD("Procedure number %d, rest len %d", new_program, len);
+static const char *shader_code_name = "pixel_vm_code";
+static struct pixel_vm_program shader = {};
+static bool shader_loaded = false;
+
+/*
+ * Segments: virtual fixtures in the overlay, each takes its WMPAYLOAD from its own universe and address
+ * and runs its own workmode. With segments set, live DMX goes to them instead of the whole strip.
+ */
+static const char *segments_name = "segments";
+#define SEGMENT_ENTRY 9 // FIRST(2) + LENGTH(2) + UNIVERSE(2) + ADDRESS(2) + WORKMODE
+struct segment {
+    uint16_t universe;
+    uint16_t address;
+    uint8_t workmode;
+    struct layer layer; // the range of the overlay, for set_program
+    struct program program;
+};
+static struct segment segments[WS2812_SEGMENTS];
+static int segment_count = 0;
+
+static const char *map_name = "pixel_map";
+static uint16_t *pixel_map = NULL; // logical pixel to physical led, NULL keeps the order
+
+/*
+ * Last look: LEN(2) + WORKMODE + WMPAYLOAD for the base and then the overlay layer, LEN is big-endian.
+ * Effects are stored as their payload, pixels as DMX_STRAIGHT, an empty part keeps the defaults.
+ */
+static const char *look_name = "last_look";
+#define LOOK_RAINBOW_MAX 15 // ID DELAY(2) STEP_TIME(2) STEP_LENGTH(2) BEGIN(3) TINT(3) TINT_LEVEL TINT_TYPE
+#define LOOK_EFFECT_MAX (1 + LOOK_RAINBOW_MAX) // WORKMODE + rainbow payload, the longest
+#define LOOK_MAX (2 * (2 + 1 + 3 * LED_NUMBER) + LOOK_EFFECT_MAX)
+static uint8_t look_effect[LOOK_EFFECT_MAX]; // payload of the base layer effect
+static int look_effect_len = 0;
+static uint32_t look_crc_seen = 0, look_crc_saved = 0;
+static TickType_t look_checked = 0, look_saved = 0;
+
+/* live frames waiting for their presentation time, in the order of it */
+#define SCHEDULE_FRAME_MAX (3 * LED_NUMBER + LOOK_EFFECT_MAX)
+struct scheduled_frame {
+    uint32_t due; // us of sdk_system_get_time
+    uint16_t len;
+    uint8_t data[SCHEDULE_FRAME_MAX]; // WORKMODE + WMPAYLOAD
+};
+static struct scheduled_frame schedule[WS2812_SCHEDULE_FRAMES];
+static int schedule_count = 0;
+
+static void save_rainbow_settings() {
+    struct program_rainbow *rainbow = &base_program.settings.rainbow;
+    config.rainbow_delay = rainbow->delay;
+    config.rainbow_step_time = rainbow->step_time;
+    config.rainbow_step_length = rainbow->step_length;
+    config.rainbow_tint[0] = rainbow->tint.red;
+    config.rainbow_tint[1] = rainbow->tint.green;
+    config.rainbow_tint[2] = rainbow->tint.blue;
+    config.rainbow_tint_level = rainbow->tint_level;
+    config.rainbow_tint_type = rainbow->tint_type;
+    config_save();
+}
+
+/**
+ * Applies the workmode with its WMPAYLOAD to the layer and its program state,
+ * must be called with ws2812_pixels_manipulation_lock taken.
+ * Marks the frame dirty unless the payload repeats the current look.
+ * Returns the applied program or -1 if the payload was rejected.
+ */
+static int set_program(struct layer *layer, struct program *prog, uint8_t new_program,
+        uint8_t *rgbbytes, int len, bool persist) {
+    ws2812_pixel_t *px = layer->pixels;
+    union program_settings_t *settings = &prog->settings;
+    uint8_t *payload = rgbbytes;
+    int payload_len = len, size = prog->size;
+    uint8_t new_id, diff;
+
+    LOGD("Procedure number %d, len %d", new_program, len);
 
     switch(new_program) {
     case DMX_STRAIGHT:
         len /= 3;
-        if(len>LED_NUMBER) len=LED_NUMBER;
+        if(len>size) len=size;
         LOGD("Starting ws2812_update DMX_STRAIGHT, len %d", len);
-        if(xSemaphoreTake(ws2812_pixels_manipulation_lock, 100) == pdTRUE) {
-            program = new_program;
-            if(pixels){
-                for(int i=0;i<len;++i, rgbbytes+=3) {
-                    pixels[i].red   = rgbbytes[0];
-                    pixels[i].green = rgbbytes[1];
-                    pixels[i].blue  = rgbbytes[2];
-                }
-            }
-            xSemaphoreGive(ws2812_pixels_manipulation_lock);
-        }else{
-            LOGE("FAILED TO TAKE LOCK");
+        // compare while copying: desks resend static looks at full rate
+        diff = layer->program != new_program || layer->count != len;
+        layer->program = new_program;
+        layer->count = len;
+        // a full strip runs the copy specialized for LED_NUMBER
+        if(len == LED_NUMBER) {
+            diff |= swar_copy_rgb(px, rgbbytes, LED_NUMBER) != 0;
+        } else {
+            diff |= swar_copy_rgb(px, rgbbytes, len) != 0;
+        }
+        if(!diff) {
+            LOGV("Same frame");
+            return new_program;
         }
         break;
     case DMX_CHAIN:
         if(len<3) {
             LOGD("Not enough data for chain.");
-            return;
+            return -1;
         }
         LOGD("Starting ws2812_update DMX_CHAIN");
-        if(xSemaphoreTake(ws2812_pixels_manipulation_lock, 100) == pdTRUE) {
-            program = new_program;
-            if(pixels){
-                for(int i=LED_NUMBER-1;i>0;--i) {
-                    pixels[i].red   = pixels[i-1].red;
-                    pixels[i].green = pixels[i-1].green;
-                    pixels[i].blue  = pixels[i-1].blue;
-                }
-                pixels[0].red   = rgbbytes[0];
-                pixels[0].green = rgbbytes[1];
-                pixels[0].blue  = rgbbytes[2];
-                LOGV("New color: %02x%02x%02x", pixels[0].red, pixels[0].green, pixels[0].blue);
-            }
-            xSemaphoreGive(ws2812_pixels_manipulation_lock);
-        }else{
-            LOGE("FAILED TO TAKE LOCK");
+        layer->program = new_program;
+        layer->count = size;
+        for(int i=size-1;i>0;--i) {
+            px[i].red   = px[i-1].red;
+            px[i].green = px[i-1].green;
+            px[i].blue  = px[i-1].blue;
         }
+        px[0].red   = rgbbytes[0];
+        px[0].green = rgbbytes[1];
+        px[0].blue  = rgbbytes[2];
+        LOGV("New color: %02x%02x%02x", px[0].red, px[0].green, px[0].blue);
         break;
     case DMX_CHAIN_REVERSED:
         if(len<3){
             LOGD("Not enough data for chain.");
-            return;
+            return -1;
         }
         LOGD("Starting ws2812_update DMX_CHAIN_REVERSED");
-        if(xSemaphoreTake(ws2812_pixels_manipulation_lock, 100) == pdTRUE) {
-            program = new_program;
-            if(pixels){
-                for(int i=0;i<LED_NUMBER - 1;++i) {
-                    pixels[i].red   = pixels[i+1].red;
-                    pixels[i].green = pixels[i+1].green;
-                    pixels[i].blue  = pixels[i+1].blue;
-                }
-                pixels[LED_NUMBER - 1].red   = rgbbytes[0];
-                pixels[LED_NUMBER - 1].green = rgbbytes[1];
-                pixels[LED_NUMBER - 1].blue  = rgbbytes[2];
-                LOGV("New color: %02x%02x%02x",
-                        pixels[LED_NUMBER - 1].red, pixels[LED_NUMBER - 1].green, pixels[LED_NUMBER - 1].blue);
-            }
-            xSemaphoreGive(ws2812_pixels_manipulation_lock);
-        }else{
-            LOGE("FAILED TO TAKE LOCK");
+        layer->program = new_program;
+        layer->count = size;
+        for(int i=0;i<size - 1;++i) {
+            px[i].red   = px[i+1].red;
+            px[i].green = px[i+1].green;
+            px[i].blue  = px[i+1].blue;
         }
+        px[size - 1].red   = rgbbytes[0];
+        px[size - 1].green = rgbbytes[1];
+        px[size - 1].blue  = rgbbytes[2];
+        LOGV("New color: %02x%02x%02x", px[size - 1].red, px[size - 1].green, px[size - 1].blue);
         break;
     case DMX_RAINBOW:
         if(len<14){
             LOGD("Not enough data for rainbow.");
-            return;
+            return -1;
         }
         LOGD("Starting ws2812_update DMX_RAINBOW");
-        if(xSemaphoreTake(ws2812_pixels_manipulation_lock, 100) == pdTRUE) {
-            uint8_t new_id = *(rgbbytes++);
-            int err;
-
-            program_settings.rainbow.delay = *(rgbbytes++);
-            program_settings.rainbow.delay <<=8;
-            program_settings.rainbow.delay += *(rgbbytes++);
-
-            program_settings.rainbow.step_time = *(rgbbytes++);
-            program_settings.rainbow.step_time <<=8;
-            program_settings.rainbow.step_time += *(rgbbytes++);
-
-            program_settings.rainbow.step_length = *(rgbbytes++);
-            program_settings.rainbow.step_length <<=8;
-            program_settings.rainbow.step_length += *(rgbbytes++);
-
-            if(program == new_program
-                    && new_id > 0
-                    && new_id == program_settings.rainbow.id) {
-                LOGD("Same Rainbow ID, skipping setting starting color.");
-                rgbbytes += 3;
-            } else {
-                program_settings.rainbow.id = new_id;
-                ws2812_pixel_t begin;
-                begin.red = *(rgbbytes++);
-                begin.green = *(rgbbytes++);
-                begin.blue = *(rgbbytes++);
-
-                SPTW_SETR(int8,program_settings.rainbow.begin.red,begin.red,);
-                SPTW_SETR(int8,program_settings.rainbow.begin.green,begin.green,);
-                SPTW_SETR(int8,program_settings.rainbow.begin.blue,begin.blue,);
-
-                rgb2hsv(&begin, &program_settings.rainbow.current);
-            }
-            program = new_program;
+        new_id = *(rgbbytes++);
 
-            program_settings.rainbow.tint.red = *(rgbbytes++);
-            program_settings.rainbow.tint.green = *(rgbbytes++);
-            program_settings.rainbow.tint.blue = *(rgbbytes++);
-            program_settings.rainbow.tint_level = *(rgbbytes++);
+        settings->rainbow.delay = *(rgbbytes++);
+        settings->rainbow.delay <<=8;
+        settings->rainbow.delay += *(rgbbytes++);
 
-            if(len>14){
-                program_settings.rainbow.tint_type = *(rgbbytes++);
-            } else {
-                program_settings.rainbow.tint_type = 0;
-            }
+        settings->rainbow.step_time = *(rgbbytes++);
+        settings->rainbow.step_time <<=8;
+        settings->rainbow.step_time += *(rgbbytes++);
 
-            LOGV("Delay %d, T step: %d, L step: %d, L[0] color: %.0f %.0f %.0f, tint: %02x%02x%02x, level: %d",
-                    program_settings.rainbow.delay,
-                    program_settings.rainbow.step_time,
-                    program_settings.rainbow.step_length,
-                    program_settings.rainbow.current.h,
-                    program_settings.rainbow.current.s,
-                    program_settings.rainbow.current.v,
-                    program_settings.rainbow.tint.red,
-                    program_settings.rainbow.tint.green,
-                    program_settings.rainbow.tint.blue,
-                    program_settings.rainbow.tint_level);
+        settings->rainbow.step_length = *(rgbbytes++);
+        settings->rainbow.step_length <<=8;
+        settings->rainbow.step_length += *(rgbbytes++);
 
-            xSemaphoreGive(ws2812_pixels_manipulation_lock);
+        if(layer->program == new_program
+                && new_id > 0
+                && new_id == settings->rainbow.id) {
+            LOGD("Same Rainbow ID, skipping setting starting color.");
+            rgbbytes += 3;
+        } else {
+            settings->rainbow.id = new_id;
+            ws2812_pixel_t begin;
+            begin.red = *(rgbbytes++);
+            begin.green = *(rgbbytes++);
+            begin.blue = *(rgbbytes++);
 
+            if(persist) {
+                config.rainbow_begin[0] = begin.red;
+                config.rainbow_begin[1] = begin.green;
+                config.rainbow_begin[2] = begin.blue;
+                config_save();
+            }
 
-            int32_t tmp;
-            tmp = program_settings.rainbow.delay;
-            SPTW_SETR(int32,program_settings.rainbow.delay,tmp,);
+            rgb2hsv(&begin, &settings->rainbow.begin);
+        }
+        if(layer->program != new_program) prog->effect_due = xTaskGetTickCount();
+        layer->program = new_program;
+        layer->count = size;
 
-            tmp = program_settings.rainbow.step_time;
-            SPTW_SETR(int32,program_settings.rainbow.step_time,tmp,);
+        settings->rainbow.tint.red = *(rgbbytes++);
+        settings->rainbow.tint.green = *(rgbbytes++);
+        settings->rainbow.tint.blue = *(rgbbytes++);
+        settings->rainbow.tint_level = *(rgbbytes++);
 
-            tmp = program_settings.rainbow.step_length;
-            SPTW_SETR(int32,program_settings.rainbow.step_length,tmp,);
+        if(len>14){
+            settings->rainbow.tint_type = *(rgbbytes++);
+        } else {
+            settings->rainbow.tint_type = 0;
+        }
 
-            SPTW_SETNR(int8,program_settings.rainbow.tint.red,);
-            SPTW_SETNR(int8,program_settings.rainbow.tint.green,);
-            SPTW_SETNR(int8,program_settings.rainbow.tint.blue,);
+        LOGV("Delay %d, T step: %d, L step: %d, L[0] color: %.0f %.0f %.0f, tint: %02x%02x%02x, level: %d",
+                settings->rainbow.delay,
+                settings->rainbow.step_time,
+                settings->rainbow.step_length,
+                settings->rainbow.begin.h,
+                settings->rainbow.begin.s,
+                settings->rainbow.begin.v,
+                settings->rainbow.tint.red,
+                settings->rainbow.tint.green,
+                settings->rainbow.tint.blue,
+                settings->rainbow.tint_level);
+        break;
+    case DMX_SHADER:
+        if(len<3){
+            LOGD("Not enough data for shader.");
+            return -1;
+        }
+        LOGD("Starting ws2812_update DMX_SHADER");
+        new_id = *(rgbbytes++);
 
-            SPTW_SETNR(int8,program_settings.rainbow.tint_level,);
-            SPTW_SETNR(int8,program_settings.rainbow.tint_type,);
-        }else{
-            LOGE("FAILED TO TAKE LOCK");
+        if(layer->program != new_program
+                || new_id == 0
+                || new_id != settings->shader.id) {
+            settings->shader.start = timesync_now_us() / 1000;
         }
+        settings->shader.id = new_id;
+        if(layer->program != new_program) prog->effect_due = xTaskGetTickCount();
+        layer->program = new_program;
+        layer->count = size;
+
+        settings->shader.delay = *(rgbbytes++);
+        settings->shader.delay <<=8;
+        settings->shader.delay += *(rgbbytes++);
+
+        len -= 3;
+        if(len > PIXEL_VM_PARAMS) len = PIXEL_VM_PARAMS;
+        for(int i=0;i<PIXEL_VM_PARAMS;++i) {
+            prog->shader_state.params[i] = i<len ? rgbbytes[i] : 0;
+        }
+        LOGV("Delay %d, params: %d", settings->shader.delay, len);
         break;
     default:
         LOGW("Undefined DMX program %d", new_program);
-        break;
+        return -1;
+    }
+    if(layer == &layers[LAYER_BASE]) {
+        // effects can't be read back from the pixels, their payload goes to the last look
+        // live frames carry the rest of the universe, only the bytes the program reads are kept
+        look_effect_len = 0;
+        if(new_program == DMX_RAINBOW || new_program == DMX_SHADER) {
+            int used = new_program == DMX_RAINBOW ? LOOK_RAINBOW_MAX : 3 + PIXEL_VM_PARAMS;
+            if(used > LOOK_EFFECT_MAX - 1) used = LOOK_EFFECT_MAX - 1;
+            if(payload_len > used) payload_len = used;
+            look_effect[0] = new_program;
+            memcpy(look_effect + 1, payload, payload_len);
+            look_effect_len = payload_len + 1;
+        }
+    }
+    frame_dirty = true;
+    return new_program;
+}
+
+/**
+ * Applies WORKMODE + WMPAYLOAD to the base or the overlay layer, see set_program.
+ */
+static int set_workmode(struct layer *layer, uint8_t *rgbbytes, int len, bool persist) {
+    if(len<1) {
+        LOGD("No bytes to process, skipping");
+        return -1;
+    }
+    return set_program(layer, &base_program, rgbbytes[0], rgbbytes + 1, len - 1, persist);
+}
+
+/**
+ * Applies live WORKMODE + WMPAYLOAD, must be called with ws2812_pixels_manipulation_lock taken.
+ * Returns the applied program or -1 if the payload was rejected.
+ */
+static int apply_live(uint8_t *rgbbytes, int len) {
+    // pixel workmodes go to the live DMX layer over the running effect
+    struct layer *layer = &layers[LAYER_BASE];
+    if(rgbbytes[0] == DMX_STRAIGHT || rgbbytes[0] == DMX_CHAIN || rgbbytes[0] == DMX_CHAIN_REVERSED) {
+        layer = &layers[LAYER_OVERLAY];
+    }
+    if(cue_playing()) {
+        LOGI("Live DMX received, stopping cue playback");
+        cue_stop();
     }
+    int applied = set_workmode(layer, rgbbytes, len, true);
+    // a new effect takes the strip back from the live pixels, unless the overlay holds the segments
+    if(applied >= 0 && layer == &layers[LAYER_BASE] && !segment_count && layers[LAYER_OVERLAY].count) {
+        LOGD("Releasing the overlay");
+        layers[LAYER_OVERLAY].count = 0;
+        frame_dirty = true;
+    }
+    return applied;
+}
+
+void ws2812_update(uint8_t *rgbbytes, int len) {
+    LOGV("Starting ws2812_update, len %d", len);
+    int applied;
+    bool refresh;
+
+    if(len<1) {
+        LOGD("No bytes to process, skipping");
+        return;
+    }
+
+    if(xSemaphoreTake(ws2812_pixels_manipulation_lock, 100) == pdTRUE) {
+        applied = apply_live(rgbbytes, len);
+        refresh = frame_dirty;
+        xSemaphoreGive(ws2812_pixels_manipulation_lock);
+    }else{
+        LOGE("FAILED TO TAKE LOCK");
+        return;
+    }
+    if(applied < 0) return;
+    if(applied == DMX_RAINBOW) save_rainbow_settings();
+    if(refresh) xEventGroupSetBits(ws2812_event_group, REFRESH_PIXELS_BIT);
+}
+
+/**
+ * Checks COUNT + segment entries, returns COUNT or negative error code.
+ */
+static int check_segments(const uint8_t *buf, size_t len) {
+    if(len < 1 || buf[0] > WS2812_SEGMENTS || len < 1 + buf[0] * SEGMENT_ENTRY) return -1;
+    for(int i=0;i<buf[0];++i) {
+        const uint8_t *e = buf + 1 + i * SEGMENT_ENTRY;
+        uint16_t first = e[0] << 8 | e[1], length = e[2] << 8 | e[3];
+        if(!length || first + length > LED_NUMBER) return -2;
+        if(e[8] > DMX_SHADER) return -3;
+    }
+    return buf[0];
+}
+
+/**
+ * Sets up the segments from a checked table, must be called with ws2812_pixels_manipulation_lock taken.
+ * The overlay is cleared, leds between the segments stay black, the base layer shows past the last one.
+ */
+static void use_segments(const uint8_t *buf) {
+    uint16_t end = 0;
+    segment_count = buf[0];
+    for(int i=0;i<segment_count;++i) {
+        const uint8_t *e = buf + 1 + i * SEGMENT_ENTRY;
+        uint16_t first = e[0] << 8 | e[1], length = e[2] << 8 | e[3];
+        segments[i] = (struct segment){
+            .universe = e[4] << 8 | e[5],
+            .address = e[6] << 8 | e[7],
+            .workmode = e[8],
+            .layer = {.program = DMX_STRAIGHT, .pixels = overlay + first},
+            .program = {.size = length},
+        };
+        if(first + length > end) end = first + length;
+        LOGD("Segment %d: leds %d-%d, universe %d, address %d, workmode %d",
+                i, first, first + length - 1, segments[i].universe, segments[i].address, e[8]);
+    }
+    memset(overlay, 0, sizeof(ws2812_pixel_t) * LED_NUMBER);
+    layers[LAYER_OVERLAY].program = DMX_STRAIGHT;
+    layers[LAYER_OVERLAY].count = end;
+    frame_dirty = true;
+}
+
+int ws2812_set_segments(uint8_t *buf, size_t len) {
+    int count, err;
+
+    if((count = check_segments(buf, len)) < 0) {
+        LOGE("Wrong segments (%d)", count);
+        return -1;
+    }
+    if(xSemaphoreTake(ws2812_pixels_manipulation_lock, 100) == pdTRUE) {
+        use_segments(buf);
+        xSemaphoreGive(ws2812_pixels_manipulation_lock);
+    }else{
+        LOGE("FAILED TO TAKE LOCK");
+        return -2;
+    }
+    if((err = sysparam_set_data(segments_name, buf, 1 + count * SEGMENT_ENTRY, true)) != SYSPARAM_OK) {
+        LOGE("sysparam_set_data %s failed (%d)", segments_name, err);
+        return -3;
+    }
+    LOGI("%d segments set", count);
     xEventGroupSetBits(ws2812_event_group, REFRESH_PIXELS_BIT);
+    return 0;
+}
 
+void ws2812_update_segments(uint16_t universe, uint8_t *dmx, int len) {
+    struct segment *segment;
+    bool refresh;
+
+    if(xSemaphoreTake(ws2812_pixels_manipulation_lock, 100) == pdTRUE) {
+        if(cue_playing()) {
+            LOGI("Live DMX received, stopping cue playback");
+            cue_stop();
+        }
+        for(segment=segments;segment<segments+segment_count;++segment) {
+            if(segment->universe != universe || segment->address >= len) continue;
+            set_program(&segment->layer, &segment->program, segment->workmode,
+                    dmx + segment->address, len - segment->address, false);
+        }
+        refresh = frame_dirty;
+        xSemaphoreGive(ws2812_pixels_manipulation_lock);
+    }else{
+        LOGE("FAILED TO TAKE LOCK");
+        return;
+    }
+    if(refresh) xEventGroupSetBits(ws2812_event_group, REFRESH_PIXELS_BIT);
 }
-#define MAX_THROTTLE (40/portTICK_PERIOD_MS)
-static void ws2812_updater(void *pvParameters) {
-    static const char* TAG = "ws2812_updater";
+
+/**
+ * Builds the map from the descriptors, returns it, NULL if it keeps the order, or sets err on failure.
+ */
+static uint16_t *build_map(const uint8_t *desc, size_t len, int *err) {
+    uint16_t *map = malloc(sizeof(uint16_t) * LED_NUMBER);
+    *err = 0;
+    if(!map) {
+        LOGE("Can't allocate the pixel map");
+        *err = -1;
+        return NULL;
+    }
+    if((*err = pixel_map_build(map, LED_NUMBER, desc, len)) != 0) {
+        free(map);
+        return NULL;
+    }
+    return map;
+}
+
+int ws2812_set_map(uint8_t *buf, size_t len) {
+    uint16_t *map, *old;
     int err;
-    TickType_t current_delay = portMAX_DELAY;
 
-    if(xSemaphoreTake(ws2812_pixels_manipulation_lock, 1000) == pdTRUE) {
-        ws2812_i2s_init(LED_NUMBER, PIXEL_RGB);
-        memset(pixels, 0, sizeof(ws2812_pixel_t) * LED_NUMBER);
+    map = build_map(buf, len, &err);
+    if(err < 0) {
+        LOGE("Wrong pixel map (%d)", err);
+        return -1;
+    }
+    if(xSemaphoreTake(ws2812_pixels_manipulation_lock, 100) == pdTRUE) {
+        old = pixel_map;
+        pixel_map = map;
+        frame_dirty = true;
+        xSemaphoreGive(ws2812_pixels_manipulation_lock);
+        free(old);
+    }else{
+        LOGE("FAILED TO TAKE LOCK");
+        free(map);
+        return -2;
+    }
+    if((err = sysparam_set_data(map_name, buf, len, true)) != SYSPARAM_OK) {
+        LOGE("sysparam_set_data %s failed (%d)", map_name, err);
+        return -3;
+    }
+    LOGI("Pixel map of %d bytes set", (int)len);
+    xEventGroupSetBits(ws2812_event_group, REFRESH_PIXELS_BIT);
+    return 0;
+}
 
+int ws2812_segment_count() {
+    return segment_count;
+}
 
-        program = DMX_RAINBOW;
+bool ws2812_segment_universe(uint16_t universe) {
+    // read without the lock by the receiver, the table changes only on a rare reconfiguration
+    for(int i=0;i<segment_count;++i) {
+        if(segments[i].universe == universe) return true;
+    }
+    return false;
+}
 
-        int32_t tmp;
-        tmp = portMAX_DELAY;
-        SPTW_GETR(int32,program_settings.rainbow.delay,tmp,);
-        program_settings.rainbow.delay = tmp;
+int ws2812_segment_universes(uint16_t *out, int max) {
+    int count = 0;
+    for(int i=0;i<segment_count;++i) {
+        int j;
+        for(j=0;j<count && out[j] != segments[i].universe;++j) {}
+        if(j == count && count < max) out[count++] = segments[i].universe;
+    }
+    return count;
+}
 
-        tmp = 0;
-        SPTW_GETR(int32,program_settings.rainbow.step_time,tmp,);
-        program_settings.rainbow.step_time = tmp;
+void ws2812_schedule(uint8_t *rgbbytes, int len, uint32_t due_us) {
+    struct scheduled_frame *frame;
+    int i;
 
-        tmp = 0;
-        SPTW_GETR(int32,program_settings.rainbow.step_length,tmp,);
-        program_settings.rainbow.step_length = tmp;
+    if(len<1) {
+        LOGD("No bytes to process, skipping");
+        return;
+    }
+    if(len > SCHEDULE_FRAME_MAX) len = SCHEDULE_FRAME_MAX;
+    if(xSemaphoreTake(ws2812_pixels_manipulation_lock, 100) == pdTRUE) {
+        if(schedule_count == WS2812_SCHEDULE_FRAMES) {
+            LOGD("Schedule is full, dropping the earliest frame");
+            --schedule_count;
+            memmove(schedule, schedule + 1, sizeof(schedule[0]) * schedule_count);
+        }
+        // kept in the order of presentation, frames may come out of order
+        for(i=schedule_count;i>0 && (int32_t)(schedule[i-1].due - due_us) > 0;--i) {
+            schedule[i] = schedule[i-1];
+        }
+        frame = &schedule[i];
+        frame->due = due_us;
+        frame->len = len;
+        memcpy(frame->data, rgbbytes, len);
+        ++schedule_count;
+        xSemaphoreGive(ws2812_pixels_manipulation_lock);
+    }else{
+        LOGE("FAILED TO TAKE LOCK");
+        return;
+    }
+    xEventGroupSetBits(ws2812_event_group, REFRESH_PIXELS_BIT);
+}
 
-        ws2812_pixel_t begin={
-                .red = 0,
-                .green = 0,
-                .blue = 0
-        };
-        SPTW_GETR(int8,program_settings.rainbow.begin.red,begin.red,);
-        SPTW_GETR(int8,program_settings.rainbow.begin.green,begin.green,);
-        SPTW_GETR(int8,program_settings.rainbow.begin.blue,begin.blue,);
+/**
+ * Applies the scheduled frames that are due, must be called with ws2812_pixels_manipulation_lock taken.
+ * Frames are due half a tick early, the updater can't wake up more precisely.
+ * Returns the ticks until the next frame is due, portMAX_DELAY if there is none.
+ */
+static TickType_t apply_scheduled() {
+    const uint32_t half_tick = portTICK_PERIOD_MS * 500;
+    uint32_t now = sdk_system_get_time();
+    int done;
 
-        rgb2hsv(&begin, &program_settings.rainbow.current);
+    for(done=0;done<schedule_count && (int32_t)(schedule[done].due - now) <= (int32_t)half_tick;++done) {
+        if(apply_live(schedule[done].data, schedule[done].len) == DMX_RAINBOW) save_rainbow_settings();
+    }
+    if(done) {
+        schedule_count -= done;
+        memmove(schedule, schedule + done, sizeof(schedule[0]) * schedule_count);
+    }
+    if(!schedule_count) return portMAX_DELAY;
+    return (schedule[0].due - now + half_tick) / (portTICK_PERIOD_MS * 1000);
+}
 
-        program_settings.rainbow.tint.red=0;
-        program_settings.rainbow.tint.green=0;
-        program_settings.rainbow.tint.blue=0;
-        SPTW_GETNR(int8,program_settings.rainbow.tint.red,);
-        SPTW_GETNR(int8,program_settings.rainbow.tint.green,);
-        SPTW_GETNR(int8,program_settings.rainbow.tint.blue,);
+void ws2812_refresh() {
+    xEventGroupSetBits(ws2812_event_group, REFRESH_PIXELS_BIT);
+}
 
-        program_settings.rainbow.tint_level=0;
-        program_settings.rainbow.tint_type=0;
-        SPTW_GETNR(int8,program_settings.rainbow.tint_level,);
-        SPTW_GETNR(int8,program_settings.rainbow.tint_type,);
+int ws2812_set_layer(uint8_t *buf, size_t len) {
+    if(len<3) {
+        LOGE("Layer settings buf is too small");
+        return -1;
+    }
+    if(buf[0] >= LAYER_COUNT || buf[2] >= BLEND_COUNT) {
+        LOGE("Wrong layer %d or blend mode %d", buf[0], buf[2]);
+        return -2;
+    }
+    if(xSemaphoreTake(ws2812_pixels_manipulation_lock, 100) == pdTRUE) {
+        struct layer *layer = &layers[buf[0]];
+        layer->opacity = buf[1];
+        layer->blend = buf[2];
+        if(layer->solid && len >= 6) {
+            layer->pixels[0].red   = buf[3];
+            layer->pixels[0].green = buf[4];
+            layer->pixels[0].blue  = buf[5];
+        }
+        frame_dirty = true;
+        xSemaphoreGive(ws2812_pixels_manipulation_lock);
+    }else{
+        LOGE("FAILED TO TAKE LOCK");
+        return -3;
+    }
+    LOGI("Layer %d opacity: %d, blend: %d", buf[0], buf[1], buf[2]);
+    ws2812_refresh();
+    return 0;
+}
+
+int ws2812_set_shader(uint8_t *code, size_t len) {
+    struct pixel_vm_program new_shader;
+    int err;
 
+    if((err = pixel_vm_load(&new_shader, code, len)) != 0) {
+        LOGE("Shader validation failed (%d)", err);
+        return -1;
+    }
+    if(xSemaphoreTake(ws2812_pixels_manipulation_lock, 100) == pdTRUE) {
+        shader = new_shader;
+        shader_loaded = true;
+        // the settings are a union, only running shaders are restarted
+        uint32_t start = timesync_now_us() / 1000;
+        if(layers[LAYER_BASE].program == DMX_SHADER) base_program.settings.shader.start = start;
+        for(int i=0;i<segment_count;++i) {
+            if(segments[i].layer.program == DMX_SHADER) segments[i].program.settings.shader.start = start;
+        }
+        frame_dirty = true;
         xSemaphoreGive(ws2812_pixels_manipulation_lock);
     }else{
         LOGE("FAILED TO TAKE LOCK");
+        return -2;
+    }
+    if((err = sysparam_set_data(shader_code_name, code, len, true)) != SYSPARAM_OK) {
+        LOGE("sysparam_set_data %s failed (%d)", shader_code_name, err);
+        return -3;
+    }
+    LOGI("New shader of %d bytes loaded", (int)len);
+    xEventGroupSetBits(ws2812_event_group, REFRESH_PIXELS_BIT);
+    return 0;
+}
+
+static void render_rainbow(struct program_rainbow *rainbow, ws2812_pixel_t *out, int count, uint64_t time_ms) {
+    // the phase follows the clock, not the frames, so nodes sharing the clock stay together
+    uint32_t steps = time_ms / (rainbow->delay ? rainbow->delay : 1) % 360;
+    color_HSV L = rainbow->begin, LT, HSVTINT;
+    L.h += steps * rainbow->step_time % 360;
+    int is_hsv_tint = rainbow->tint_type >= 128;
+    float tint_norm = (float)rainbow->tint_level / 255.;
+
+    if(is_hsv_tint){
+        rgb2hsv(&rainbow->tint, &HSVTINT);
+    }
+
+    IFLOGV(ws2812_pixel_t p1;hsv2rgb(&L, &p1);)
+    LOGV("start color: %.0f %.0f %.0f, rgb: %02x%02x%02x",
+            L.h, L.s, L.v,
+            p1.red, p1.green, p1.blue);
+    for(int i=0;i<count;++i){
+        if(is_hsv_tint) {
+            LT.h = (L.h * (1.-tint_norm)) + (HSVTINT.h * tint_norm);
+            LT.s = (L.s * (1.-tint_norm)) + (HSVTINT.s * tint_norm);
+            LT.v = (L.v * (1.-tint_norm)) + (HSVTINT.v * tint_norm);
+            hsv2rgb(&LT, &(out[i]));
+        } else {
+            hsv2rgb(&L, &(out[i]));
+        }
+
+        L.h += rainbow->step_length;
+        if(L.h >= 360) L.h -= 360;
+    }
+    if(!is_hsv_tint) {
+        // the RGB tint is blended over the rendered strip in one pass
+        if(count == LED_NUMBER) {
+            swar_tint(out, LED_NUMBER, &rainbow->tint, rainbow->tint_level);
+        } else {
+            swar_tint(out, count, &rainbow->tint, rainbow->tint_level);
+        }
+    }
+}
+
+void ws2812_rainbow_render(ws2812_pixel_t *out, int count, uint64_t time_ms) {
+    render_rainbow(&base_program.settings.rainbow, out, count, time_ms);
+}
+
+/**
+ * Saves the visible base layer look as the beginning of the next crossfade.
+ */
+static void snapshot_base() {
+    struct layer *base = &layers[LAYER_BASE];
+    if(base->fade_weight >= LAYER_FADE_DONE) {
+        memcpy(fade_from, pixels, sizeof(ws2812_pixel_t) * LED_NUMBER);
+        return;
+    }
+    int rest = LAYER_FADE_DONE - base->fade_weight;
+    for(int i=0;i<LED_NUMBER;++i) {
+        fade_from[i].red   = (fade_from[i].red   * rest + pixels[i].red   * base->fade_weight) >> 8;
+        fade_from[i].green = (fade_from[i].green * rest + pixels[i].green * base->fade_weight) >> 8;
+        fade_from[i].blue  = (fade_from[i].blue  * rest + pixels[i].blue  * base->fade_weight) >> 8;
+    }
+}
+
+/**
+ * Leaves the pixels a shorter DMX_STRAIGHT cue doesn't cover at the previous look instead of cutting them
+ * to black, must be called after snapshot_base.
+ */
+static void keep_uncovered(struct layer *base) {
+    if(base->count >= LED_NUMBER) return;
+    memcpy(base->pixels + base->count, fade_from + base->count, sizeof(ws2812_pixel_t) * (LED_NUMBER - base->count));
+    base->count = LED_NUMBER;
+}
+
+static inline bool tick_reached(TickType_t now, TickType_t t) {
+    return (int32_t)(now - t) >= 0;
+}
+
+/**
+ * Returns the frame period of the effect running in the layer in ticks, 0 if it isn't an effect.
+ */
+static TickType_t effect_period(const struct layer *layer, const struct program *prog) {
+    TickType_t period;
+    switch(layer->program) {
+    case DMX_RAINBOW:
+        period = prog->settings.rainbow.delay / portTICK_PERIOD_MS;
+        break;
+    case DMX_SHADER:
+        if(!shader_loaded) return 0;
+        period = prog->settings.shader.delay / portTICK_PERIOD_MS;
+        break;
+    default:
+        return 0;
+    }
+    return period < 1 ? 1 : period;
+}
+
+/**
+ * Renders the next frame of the effect running in the layer.
+ */
+static void render_effect(struct layer *layer, struct program *prog) {
+    switch(layer->program) {
+    case DMX_RAINBOW:
+        render_rainbow(&prog->settings.rainbow, layer->pixels, prog->size, timesync_now_us() / 1000);
+        break;
+    case DMX_SHADER:
+        pixel_vm_frame(&shader, &prog->shader_state,
+                (uint32_t)(timesync_now_us() / 1000) - prog->settings.shader.start, prog->size);
+        pixel_vm_render(&shader, &prog->shader_state, layer->pixels, prog->size);
+        break;
+    }
+    frame_dirty = true;
+}
+
+/**
+ * Renders the effect of the layer if its frame is due.
+ * Returns the ticks until its next frame, or delay if that is sooner or it isn't an effect.
+ */
+static TickType_t run_effect(struct layer *layer, struct program *prog, TickType_t now, TickType_t delay) {
+    TickType_t period = effect_period(layer, prog);
+    if(!period) return delay;
+    if(tick_reached(now, prog->effect_due)) {
+        render_effect(layer, prog);
+        prog->effect_due += period;
+        if(tick_reached(now, prog->effect_due)) prog->effect_due = now + period; // too late, don't catch up
+    }
+    return prog->effect_due - now < delay ? prog->effect_due - now : delay;
+}
+
+static uint8_t *put_look_layer(uint8_t *p, struct layer *layer) {
+    uint8_t *start = p;
+    p += 2;
+    if(layer->program == DMX_RAINBOW || layer->program == DMX_SHADER) {
+        memcpy(p, look_effect, look_effect_len);
+        p += look_effect_len;
+    } else {
+        *(p++) = DMX_STRAIGHT;
+        for(int i=0;i<layer->count;++i) {
+            *(p++) = layer->pixels[i].red;
+            *(p++) = layer->pixels[i].green;
+            *(p++) = layer->pixels[i].blue;
+        }
+    }
+    start[0] = (p - start - 2) >> 8;
+    start[1] = (p - start - 2) & 0xff;
+    return p;
+}
+
+/**
+ * Saves the look once it is stable, at most every WS2812_LOOK_INTERVAL ms to spare the flash.
+ * Must be called with ws2812_pixels_manipulation_lock taken.
+ */
+static void check_look(TickType_t now) {
+    uint8_t *look;
+    size_t len;
+    uint32_t crc;
+
+    if(cue_playing()) return; // cues are stored by themselves
+    if(!(look = malloc(LOOK_MAX))) {
+        LOGE("Can't allocate %d bytes for the look", LOOK_MAX);
+        return;
+    }
+    len = put_look_layer(put_look_layer(look, &layers[LAYER_BASE]), &layers[LAYER_OVERLAY]) - look;
+    crc = config_crc32(look, len);
+    if(crc == look_crc_seen && crc != look_crc_saved
+            && tick_reached(now, look_saved + WS2812_LOOK_INTERVAL / portTICK_PERIOD_MS)) {
+        LOGI("Saving the look of %d bytes", (int)len);
+        look_crc_saved = crc;
+        look_saved = now;
+        config_save_data(look_name, look, len);
+        look = NULL;
+    }
+    look_crc_seen = crc;
+    free(look);
+}
+
+/**
+ * Applies the saved look, must be called with ws2812_pixels_manipulation_lock taken.
+ */
+static void restore_look() {
+    uint8_t *look = NULL, *p;
+    size_t len = 0, part;
+    bool is_binary;
+    int err;
+
+    if((err = sysparam_get_data(look_name, &look, &len, &is_binary)) < SYSPARAM_OK) {
+        LOGE("sysparam_get_data %s failed (%d)", look_name, err);
+    }
+    if(!look) return;
+    p = look;
+    for(int i=LAYER_BASE;i<=LAYER_OVERLAY;++i) {
+        if(len < 2 || (part = (p[0] << 8) | p[1]) > len - 2) {
+            LOGE("Last look is corrupt");
+            break;
+        }
+        p += 2;
+        len -= 2;
+        if(part) set_workmode(&layers[i], p, part, false);
+        p += part;
+        len -= part;
+    }
+    look_crc_seen = look_crc_saved = config_crc32(look, p - look);
+    LOGI("Last look restored");
+    free(look);
+}
+
+/**
+ * Waits until the strip has received and latched the previous frame.
+ * Waits shorter than WS2812_SPIN_US are spun, longer ones are rounded up to ticks to let the network run.
+ */
+static void wait_strip_ready() {
+    uint32_t busy = sdk_system_get_time() - last_output_us;
+    if(busy >= WS2812_FRAME_US) return;
+    uint32_t left = WS2812_FRAME_US - busy;
+    if(left >= WS2812_SPIN_US) {
+        vTaskDelay((left + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000));
+        return;
+    }
+    while(sdk_system_get_time() - last_output_us < WS2812_FRAME_US) {}
+}
+/**
+ * Loads the stored settings, must be called with ws2812_pixels_manipulation_lock taken.
+ */
+static void load_settings() {
+    int err;
+
+    ws2812_i2s_init(LED_NUMBER, WS2812_PIXEL_TYPE);
+    memset(pixels, 0, sizeof(ws2812_pixel_t) * LED_NUMBER);
+    memset(overlay, 0, sizeof(ws2812_pixel_t) * LED_NUMBER);
+    memset(output, 0, sizeof(ws2812_pixel_t) * LED_NUMBER);
+
+
+    struct program_rainbow *rainbow = &base_program.settings.rainbow;
+    rainbow->delay = config.rainbow_delay;
+    rainbow->step_time = config.rainbow_step_time;
+    rainbow->step_length = config.rainbow_step_length;
+
+    ws2812_pixel_t begin={
+            .red = config.rainbow_begin[0],
+            .green = config.rainbow_begin[1],
+            .blue = config.rainbow_begin[2]
+    };
+    rgb2hsv(&begin, &rainbow->begin);
+
+    rainbow->tint.red = config.rainbow_tint[0];
+    rainbow->tint.green = config.rainbow_tint[1];
+    rainbow->tint.blue = config.rainbow_tint[2];
+    rainbow->tint_level = config.rainbow_tint_level;
+    rainbow->tint_type = config.rainbow_tint_type;
+
+    uint8_t *shader_code = NULL;
+    size_t shader_len = 0;
+    bool is_binary;
+    if((err = sysparam_get_data(shader_code_name, &shader_code, &shader_len, &is_binary)) < SYSPARAM_OK) {
+        LOGE("sysparam_get_data %s failed (%d)", shader_code_name, err);
+    }
+    if(shader_code) {
+        shader_loaded = pixel_vm_load(&shader, shader_code, shader_len) == 0;
+        free(shader_code);
     }
+
+    uint8_t *desc = NULL;
+    size_t desc_len = 0;
+    if((err = sysparam_get_data(map_name, &desc, &desc_len, &is_binary)) < SYSPARAM_OK) {
+        LOGE("sysparam_get_data %s failed (%d)", map_name, err);
+    }
+    if(desc) {
+        pixel_map = build_map(desc, desc_len, &err);
+        if(err < 0) LOGE("Pixel map is corrupt");
+        free(desc);
+    }
+
+    uint8_t *table = NULL;
+    size_t table_len = 0;
+    if((err = sysparam_get_data(segments_name, &table, &table_len, &is_binary)) < SYSPARAM_OK) {
+        LOGE("sysparam_get_data %s failed (%d)", segments_name, err);
+    }
+    if(table) {
+        if(check_segments(table, table_len) >= 0) {
+            use_segments(table);
+        } else {
+            LOGE("Segments are corrupt");
+        }
+        free(table);
+    }
+}
+
+static void ws2812_updater(void *pvParameters) {
+    static const char* TAG = "ws2812_updater";
+    TickType_t delay, now, scheduled;
+    struct cue next_cue;
+    uint16_t fade_weight;
+    bool probed;
+    uint32_t output_us = 0;
+
     LOGI("Started task");
 
     while (1) {
+        // new data is shown as soon as the strip can take it, effects run on their own deadlines
+        wait_strip_ready();
+        delay = WS2812_KEEPALIVE / portTICK_PERIOD_MS;
         if(xSemaphoreTake(ws2812_pixels_manipulation_lock, 10) == pdTRUE) {
-            switch(program) {
-            case DMX_RAINBOW:
-                current_delay = program_settings.rainbow.delay / portTICK_PERIOD_MS;
-                if(current_delay < 1) current_delay = 1;
-                program_settings.rainbow.current.h += program_settings.rainbow.step_time;
-
-                color_HSV L = program_settings.rainbow.current, LT, HSVTINT;
-                int is_hsv_tint = program_settings.rainbow.tint_type >= 128;
-                float tint_norm = (float)program_settings.rainbow.tint_level / 255.;
-
-                if(is_hsv_tint){
-                    rgb2hsv(&program_settings.rainbow.tint, &HSVTINT);
+            if(cue_poll(&next_cue)) {
+                snapshot_base();
+                if(set_workmode(&layers[LAYER_BASE], next_cue.payload, next_cue.len, false) == DMX_STRAIGHT) {
+                    keep_uncovered(&layers[LAYER_BASE]);
                 }
+                cue_free(&next_cue);
+            }
+            if((scheduled = apply_scheduled()) < delay) delay = scheduled;
+            now = xTaskGetTickCount();
+            delay = run_effect(&layers[LAYER_BASE], &base_program, now, delay);
+            for(int i=0;i<segment_count;++i) {
+                delay = run_effect(&segments[i].layer, &segments[i].program, now, delay);
+            }
 
-                IFLOGV(ws2812_pixel_t p1;hsv2rgb(&L, &p1);)
-                LOGV("start color: %.0f %.0f %.0f, rgb: %02x%02x%02x",
-                        L.h, L.s, L.v,
-                        p1.red, p1.green, p1.blue);
-                for(int i=0;i<LED_NUMBER;++i){
-                    ws2812_pixel_t p;
-                    if(is_hsv_tint) {
-                        LT.h = (L.h * (1.-tint_norm)) + (HSVTINT.h * tint_norm);
-                        LT.s = (L.s * (1.-tint_norm)) + (HSVTINT.s * tint_norm);
-                        LT.v = (L.v * (1.-tint_norm)) + (HSVTINT.v * tint_norm);
-                        hsv2rgb(&LT, &(pixels[i]));
-                    } else {
-                        hsv2rgb(&L, &p);
-                        pixels[i].red = (uint8_t)((((uint16_t)p.red)*(255-program_settings.rainbow.tint_level) +
-                                ((uint16_t)program_settings.rainbow.tint.red)*(program_settings.rainbow.tint_level))/255);
-                        pixels[i].green = (uint8_t)((((uint16_t)p.green)*(255-program_settings.rainbow.tint_level) +
-                                ((uint16_t)program_settings.rainbow.tint.green)*(program_settings.rainbow.tint_level))/255);
-                        pixels[i].blue = (uint8_t)((((uint16_t)p.blue)*(255-program_settings.rainbow.tint_level) +
-                                ((uint16_t)program_settings.rainbow.tint.blue)*(program_settings.rainbow.tint_level))/255);
-                    }
-
-                    L.h += program_settings.rainbow.step_length;
-                }
-                break;
-            default:
-                current_delay = portMAX_DELAY;
+            fade_weight = cue_fade_weight();
+            if(fade_weight != layers[LAYER_BASE].fade_weight) frame_dirty = true;
+            layers[LAYER_BASE].fade_weight = fade_weight;
+
+            // unchanged frames are sent only as a keepalive, to fix the strip after glitches, or for a probe
+            probed = probe_pending();
+            if(frame_dirty || probed || tick_reached(now, last_output + WS2812_KEEPALIVE / portTICK_PERIOD_MS)) {
+                compositor_run(layers, LAYER_COUNT, output, LED_NUMBER, pixel_map);
+                last_output_us = sdk_system_get_time();
+                ws2812_i2s_update(output, WS2812_PIXEL_TYPE);
+                output_us = sdk_system_get_time();
+                frame_dirty = false;
+                last_output = now;
+            }
+            if(WS2812_LOOK_INTERVAL && tick_reached(now, look_checked + WS2812_LOOK_STABLE / portTICK_PERIOD_MS)) {
+                look_checked = now;
+                check_look(now);
             }
-            ws2812_i2s_update(pixels, PIXEL_RGB);
             xSemaphoreGive(ws2812_pixels_manipulation_lock);
+            if(probed) probe_frame(last_output_us, output_us);
+
+            uint32_t cue_delay = cue_next_event();
+            if(cue_delay != UINT32_MAX) {
+                cue_delay /= portTICK_PERIOD_MS;
+                if(cue_delay < 1) cue_delay = 1;
+                if(cue_delay < delay) delay = cue_delay;
+            }
         }else{
             LOGE("FAILED TO TAKE LOCK");
         }
 
-        if(current_delay > MAX_THROTTLE) {
-            current_delay -= MAX_THROTTLE;
-            vTaskDelay(MAX_THROTTLE);
-            xEventGroupWaitBits(
-                    ws2812_event_group,
-                    REFRESH_PIXELS_BIT,
-                    pdTRUE,
-                    pdFALSE,
-                    current_delay);
-        } else {
-            vTaskDelay(current_delay);
-            xEventGroupClearBits(ws2812_event_group, REFRESH_PIXELS_BIT);
-        }
-
+        xEventGroupWaitBits(
+                ws2812_event_group,
+                REFRESH_PIXELS_BIT,
+                pdTRUE,
+                pdFALSE,
+                delay);
     }
     vTaskDelete( NULL );
 }
 
 void ws2812_init() {
     pixels=malloc(sizeof(ws2812_pixel_t)*LED_NUMBER);
+    overlay=malloc(sizeof(ws2812_pixel_t)*LED_NUMBER);
+    output=malloc(sizeof(ws2812_pixel_t)*LED_NUMBER);
+    fade_from=malloc(sizeof(ws2812_pixel_t)*LED_NUMBER);
+
+    layers[LAYER_BASE] = (struct layer){
+        .program = DMX_RAINBOW, .opacity = 255, .blend = BLEND_REPLACE, .count = LED_NUMBER,
+        .fade_weight = LAYER_FADE_DONE, .pixels = pixels, .fade_from = fade_from,
+    };
+    layers[LAYER_OVERLAY] = (struct layer){
+        .program = DMX_STRAIGHT, .opacity = 255, .blend = BLEND_REPLACE, .count = 0,
+        .fade_weight = LAYER_FADE_DONE, .pixels = overlay,
+    };
+    layers[LAYER_MASTER] = (struct layer){
+        .opacity = 255, .blend = BLEND_MULTIPLY, .solid = 1,
+        .fade_weight = LAYER_FADE_DONE, .pixels = &master_color,
+    };
+    cue_init();
     ws2812_event_group = xEventGroupCreate();
     ws2812_pixels_manipulation_lock = xSemaphoreCreateMutex();
-    xTaskCreate(&ws2812_updater, "ws2812_updater", 512, NULL, 10, NULL);
+
+    // first light: the look goes out before the network starts
+    if(xSemaphoreTake(ws2812_pixels_manipulation_lock, 1000) == pdTRUE) {
+        load_settings();
+        if(WS2812_LOOK_INTERVAL) restore_look();
+        last_output = look_checked = xTaskGetTickCount();
+        look_saved = last_output - WS2812_LOOK_INTERVAL / portTICK_PERIOD_MS;
+        if(effect_period(&layers[LAYER_BASE], &base_program)) {
+            render_effect(&layers[LAYER_BASE], &base_program);
+            base_program.effect_due = last_output + effect_period(&layers[LAYER_BASE], &base_program);
+        }
+        compositor_run(layers, LAYER_COUNT, output, LED_NUMBER, pixel_map);
+        last_output_us = sdk_system_get_time();
+        ws2812_i2s_update(output, WS2812_PIXEL_TYPE);
+        frame_dirty = false;
+        xSemaphoreGive(ws2812_pixels_manipulation_lock);
+        monitor_first_light(last_output_us);
+    }else{
+        LOGE("FAILED TO TAKE LOCK");
+    }
+
+    TaskHandle_t task = NULL;
+    xTaskCreate(&ws2812_updater, "ws2812_updater", 512, NULL, 10, &task);
+    monitor_register(task);
 }
 
@@ -2,19 +2,110 @@
 #define __WS2812_H1__
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "color_conv.h"
+#include "pixel_format.h"
 
 #ifndef LED_NUMBER
     #define LED_NUMBER 34
 #endif
 
+#ifndef WS2812_RESET_US
+    #define WS2812_RESET_US 300 /* latch time, newer WS2812B need 280 us */
+#endif
+
+#ifndef WS2812_SPIN_US
+    #define WS2812_SPIN_US 2000 /* shorter waits for the strip are busy-waited */
+#endif
+
+/* wire time of a frame: 24 or 32 bits of 1.25 us per led, plus the latch */
+#define WS2812_FRAME_US (LED_NUMBER * WS2812_PIXEL_BITS * 5 / 4 + WS2812_RESET_US)
+
+#ifndef WS2812_KEEPALIVE
+    #define WS2812_KEEPALIVE 1000 /* ms, unchanged frames are resent this often */
+#endif
+
+#ifndef WS2812_SCHEDULE_FRAMES
+    #define WS2812_SCHEDULE_FRAMES 4 /* live frames waiting for their presentation time */
+#endif
+
+#ifndef WS2812_SEGMENTS
+    #define WS2812_SEGMENTS 8 /* virtual fixtures on the strip */
+#endif
+
+#ifndef WS2812_LOOK_INTERVAL
+    #define WS2812_LOOK_INTERVAL 300000 /* ms between snapshots of the look to flash, 0 disables the last look */
+#endif
+
+#ifndef WS2812_LOOK_STABLE
+    #define WS2812_LOOK_STABLE 5000 /* ms, a look is saved after it stays unchanged this long */
+#endif
+
 enum {
     DMX_STRAIGHT = 0,
     DMX_CHAIN,
     DMX_CHAIN_REVERSED,
     DMX_RAINBOW,
+    DMX_SHADER,
+};
+
+enum {
+    LAYER_BASE = 0, // effects and cues
+    LAYER_OVERLAY,  // live DMX pixels
+    LAYER_MASTER,   // single color over the whole strip
+    LAYER_COUNT
 };
 
 void ws2812_update(uint8_t *rgbbytes, int len);
+
+/**
+ * Queues live WORKMODE + WMPAYLOAD to be applied by the updater at due_us of sdk_system_get_time.
+ * If the queue is full, the earliest frame is dropped.
+ */
+void ws2812_schedule(uint8_t *rgbbytes, int len, uint32_t due_us);
+int ws2812_set_shader(uint8_t *code, size_t len);
+
+/**
+ * Sets the segments: COUNT + COUNT * (FIRST + LENGTH + UNIVERSE + ADDRESS + WORKMODE), see README.
+ * COUNT 0 removes them, the strip is then one fixture again.
+ */
+int ws2812_set_segments(uint8_t *buf, size_t len);
+
+/**
+ * Sets the mapping of logical pixels to leds from descriptors, see pixel_map.h and README.
+ * MAP_NONE alone restores the wiring order.
+ */
+int ws2812_set_map(uint8_t *buf, size_t len);
+
+/**
+ * Applies the DMX data of the universe, from channel 1 on, to every segment taking it in one pass.
+ */
+void ws2812_update_segments(uint16_t universe, uint8_t *dmx, int len);
+int ws2812_segment_count();
+
+/**
+ * Returns true if a segment takes its DMX from the universe.
+ */
+bool ws2812_segment_universe(uint16_t universe);
+
+/**
+ * Fills out with the distinct universes the segments take, returns their count.
+ */
+int ws2812_segment_universes(uint16_t *out, int max);
+int ws2812_set_layer(uint8_t *buf, size_t len);
+void ws2812_refresh();
+
+/**
+ * Renders the rainbow at time_ms of the shared clock into out.
+ * Used by the updater with the pixels lock held, exposed for the host benchmarks.
+ */
+void ws2812_rainbow_render(ws2812_pixel_t *out, int count, uint64_t time_ms);
+
+/**
+ * Restores the last look and sends the first frame before the updater starts.
+ */
 void ws2812_init();
 
 #endif//__WS2812_H1__